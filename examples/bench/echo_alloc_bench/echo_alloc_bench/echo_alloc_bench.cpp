@@ -0,0 +1,120 @@
+// echo_alloc_bench.cpp : allocator traffic of ProtobufCodec::onMessage with
+// and without the per-batch Arena (setArenaBlockSize).
+//
+// usage: echo_alloc_bench [messages] [batch] [arena block size]
+// Feeds pre-encoded Echo.Request frames to the codec, batch frames per
+// onMessage call as if they had arrived in one read. The handler answers
+// each with an encoded Echo.Response like the echo server does, without a
+// socket. Global operator new is counted to report allocations per message;
+// each mode runs five times and the fastest run is printed.
+
+#include "stdafx.h"
+#include "../../../echo/proto/echo.pb.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+using namespace netpp;
+
+namespace {
+std::atomic<uint64_t> g_allocations(0);
+}
+
+void* operator new(size_t size) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) throw() {
+	free(p);
+}
+
+void operator delete(void* p, size_t) throw() {
+	free(p);
+}
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+std::string encodeRequests(int count) {
+	std::string frames;
+	for (int i = 0; i < count; ++i) {
+		Echo::Request request;
+		request.set_id(i);
+		request.set_ask("hello, this is a small echo request");
+		Buffer buf;
+		ProtobufCodec::fillEmptyBuffer(&buf, request);
+		std::string frame;
+		buf.readAll(frame);
+		frames += frame;
+	}
+	return frames;
+}
+
+struct Result
+{
+	double ns_per_message;
+	double allocations_per_message;
+};
+
+Result run(size_t arenaBlockSize, int messages, int batch, const std::string& frames) {
+	uint64_t echoed = 0;
+	ProtobufCodec codec([&](const TCPConnPtr&, const MessagePtr& message) {
+		const Echo::Request* request = static_cast<const Echo::Request*>(message.get());
+		Echo::Response response;
+		response.set_id(request->id());
+		response.set_answer(request->ask());
+		Buffer reply;
+		ProtobufCodec::fillEmptyBuffer(&reply, response);
+		++echoed;
+	});
+	codec.setArenaBlockSize(arenaBlockSize);
+
+	Buffer wire;
+	uint64_t before = g_allocations.load();
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < messages / batch; ++i) {
+		wire.write(frames);
+		codec.onMessage(TCPConnPtr(), &wire);
+	}
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	uint64_t allocations = g_allocations.load() - before;
+	Result result = { ns / echoed, (double)allocations / echoed };
+	return result;
+}
+}
+
+int main(int argc, char* argv[])
+{
+	int messages = argc > 1 ? atoi(argv[1]) : 1000000;
+	int batch = argc > 2 ? atoi(argv[2]) : 64;
+	int blockSize = argc > 3 ? atoi(argv[3]) : 4096;
+	if (messages <= 0 || batch <= 0 || batch > messages || blockSize <= 0) {
+		printf("usage: echo_alloc_bench [messages] [batch] [arena block size]\n");
+		return 1;
+	}
+
+	std::string frames = encodeRequests(batch);
+	// interleaved and best of several, timings on a busy machine are noisy
+	const int kRuns = 5;
+	Result best[2] = { { 1e30, 0 }, { 1e30, 0 } };
+	for (int r = 0; r < kRuns; ++r) {
+		for (int mode = 0; mode < 2; ++mode) {
+			Result result = run(mode ? (size_t)blockSize : 0, messages, batch, frames);
+			if (result.ns_per_message < best[mode].ns_per_message) {
+				best[mode] = result;
+			}
+		}
+	}
+	for (int mode = 0; mode < 2; ++mode) {
+		printf("%-6s %.0f ns/msg, %.2f allocations/msg\n", mode ? "arena" : "heap",
+			best[mode].ns_per_message, best[mode].allocations_per_message);
+	}
+	return 0;
+}
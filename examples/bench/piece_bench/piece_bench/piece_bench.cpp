@@ -0,0 +1,150 @@
+// piece_bench.cpp : compares the slab piece pool with the old inline layout
+// (a 4112 byte struct with the payload behind next/off/len, one new each).
+//
+// usage: piece_bench [inline|slab|arena|all] [pieces]
+// Prints resident memory per piece and 4 KiB memcpy throughput into pieces
+// visited in random order. For TLB misses run a single layout under a
+// profiler, e.g. perf stat -e dTLB-load-misses,dTLB-store-misses on Linux
+// or a VTune memory access analysis on Windows. arena must run on its own,
+// the pool mode is fixed by the first newPiece().
+
+#include "stdafx.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace netpp;
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+struct InlinePiece
+{
+	InlinePiece* next;
+	uint16_t off;
+	uint16_t len;
+	char data[kPieceCapacity];
+};
+
+size_t residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return 0;
+#else
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		return 0;
+	}
+	unsigned long size = 0, resident = 0;
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(f);
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+double seconds(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Copies a 4 KiB block into every payload, rounds times, visiting the
+// pieces in a fixed pseudo-random order so neighbours are not hot.
+double copyThroughput(const std::vector<char*>& payloads, int rounds) {
+	static char block[kPieceCapacity];
+	memset(block, 7, sizeof(block));
+	size_t n = payloads.size();
+	size_t step = 7919 % n == 0 ? 1 : 7919;
+	Clock::time_point start = Clock::now();
+	for (int r = 0; r < rounds; ++r) {
+		size_t j = r;
+		for (size_t i = 0; i < n; ++i) {
+			j = (j + step) % n;
+			memcpy(payloads[j], block, kPieceCapacity);
+		}
+	}
+	return (double)rounds * n * kPieceCapacity / seconds(start) / 1e9;
+}
+
+void report(const char* layout, size_t pieces, double alloc_s, size_t rss_delta, double gbps) {
+	printf("%-7s pieces=%lu alloc+touch=%.1f ms resident/piece=%.0f B memcpy=%.2f GB/s\n",
+		layout, (unsigned long)pieces, alloc_s * 1000, (double)rss_delta / pieces, gbps);
+}
+
+void runInline(size_t pieces, int rounds) {
+	std::vector<InlinePiece*> items(pieces);
+	std::vector<char*> payloads(pieces);
+	size_t rss = residentBytes();
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < pieces; ++i) {
+		items[i] = new InlinePiece;
+		memset(items[i]->data, 1, kPieceCapacity);
+		payloads[i] = items[i]->data;
+	}
+	double alloc_s = seconds(start);
+	size_t grown = residentBytes() - rss;
+	report("inline", pieces, alloc_s, grown, copyThroughput(payloads, rounds));
+	for (size_t i = 0; i < pieces; ++i) {
+		delete items[i];
+	}
+}
+
+void runPool(const char* layout, size_t pieces, int rounds) {
+	std::vector<Piece*> items(pieces);
+	std::vector<char*> payloads(pieces);
+	size_t rss = residentBytes();
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < pieces; ++i) {
+		items[i] = newPiece();
+		memset(items[i]->data, 1, kPieceCapacity);
+		payloads[i] = items[i]->data;
+	}
+	double alloc_s = seconds(start);
+	size_t grown = residentBytes() - rss;
+	report(layout, pieces, alloc_s, grown, copyThroughput(payloads, rounds));
+	for (size_t i = 0; i < pieces; ++i) {
+		deletePiece(items[i]);
+	}
+}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string mode = argc > 1 ? argv[1] : "all";
+	size_t pieces = argc > 2 ? (size_t)atol(argv[2]) : 50000;
+	const int rounds = 20;
+	if (pieces == 0) {
+		printf("usage: piece_bench [inline|slab|arena|all] [pieces]\n");
+		return 1;
+	}
+
+	if (mode == "arena") {
+		PieceArenaOptions options;
+		if (!enablePieceArena(options)) {
+			printf("arena mode unavailable\n");
+			return 1;
+		}
+		runPool("arena", pieces, rounds);
+		PiecePoolStats stats = getPiecePoolStats();
+		printf("huge pages: %s\n", stats.huge_pages ? "yes" : "no");
+		return 0;
+	}
+	if (mode == "inline" || mode == "all") {
+		runInline(pieces, rounds);
+	}
+	if (mode == "slab" || mode == "all") {
+		runPool("slab", pieces, rounds);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+// search_bench.cpp : Buffer::findDelimiter against memchr and std::search.
+//
+// usage: search_bench [MiB]
+// The delimiter sits at the very end, so every search scans the whole
+// buffer. The Buffer is a chain of 4 KiB pieces, the baselines run over one
+// flat copy of the same bytes.
+
+#include "stdafx.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+using namespace netpp;
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+const int kRounds = 20;
+// keeps the searches from being optimized away
+volatile size_t g_sink;
+
+void run(const char* name, size_t bytes, const std::function<size_t()>& search) {
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < kRounds; ++i) {
+		found += search();
+	}
+	double s = std::chrono::duration<double>(Clock::now() - start).count();
+	g_sink = found;
+	printf("%-30s %6.2f GB/s\n", name, (double)kRounds * bytes / s / 1e9);
+}
+
+size_t bytewiseCRLF(const std::string& flat) {
+	const char* p = flat.data();
+	for (size_t i = 0; i + 1 < flat.size(); ++i) {
+		if (p[i] == '\r' && p[i + 1] == '\n') {
+			return i;
+		}
+	}
+	return std::string::npos;
+}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t mib = argc > 1 ? (size_t)atol(argv[1]) : 64;
+	if (mib == 0) {
+		printf("usage: search_bench [MiB]\n");
+		return 1;
+	}
+
+	std::string flat(mib << 20, 'a');
+	flat += "\r\n";
+	Buffer buf;
+	buf.write(flat);
+	const size_t bytes = flat.size();
+	const char crlf[] = "\r\n";
+
+	printf("kernel: %s, %lu MiB\n", searchKernelName(), (unsigned long)mib);
+	run("Buffer::findDelimiter('\\n')", bytes, [&]() { return buf.findDelimiter('\n'); });
+	run("memchr, flat", bytes, [&]() {
+		return (size_t)((const char*)memchr(flat.data(), '\n', flat.size()) - flat.data());
+	});
+	run("Buffer::findCRLF", bytes, [&]() { return buf.findCRLF(); });
+	run("std::search CRLF, flat", bytes, [&]() {
+		return (size_t)(std::search(flat.begin(), flat.end(), crlf, crlf + 2) - flat.begin());
+	});
+	run("bytewise CRLF loop, flat", bytes, [&]() { return bytewiseCRLF(flat); });
+	return 0;
+}
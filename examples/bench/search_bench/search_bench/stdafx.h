@@ -0,0 +1,20 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+
+#pragma once
+
+#include "targetver.h"
+#include <stdio.h>
+#include <tchar.h>
+
+
+#include <netpp/net/buffer.h>
+#include <netpp/net/piece/piece_search.h>
+
+#if _DEBUG
+#pragma comment(lib, "../../../../netpp/lib/x86/netpp13d.lib")
+#else
+#pragma comment(lib, "../../../../netpp/lib/x86/netpp13.lib")
+#endif
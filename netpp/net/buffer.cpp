@@ -1,5 +1,6 @@
 #include <netpp/net/buffer.h>
 #include <netpp/net/piece/piece_allocator.h>
+#include <netpp/net/piece/piece_search.h>
 
 namespace netpp {
 Buffer::Buffer()
@@ -25,30 +26,35 @@ void Buffer::reservedPrepend(size_t len) {
 	assert(length() == 0);
 	assert(front() == nullptr);
 	Piece* item = newPiece();
-	assert(len < sizeof(item->data));
+	assert(len < kPieceCapacity);
 	item->off = len;
 	item->len = 0;
 	push(item);
 }
 
 void Buffer::prependInt32(int32_t x) {
-	int32_t v = htonl(x);
-	prepend(sizeof(v), (char*)&v);
+	prepend<int32_t>(x);
 }
 
 void Buffer::prependInt16(int16_t x) {
-	int16_t v = htons(x);
-	prepend(sizeof(v), (char*)&v);
+	prepend<int16_t>(x);
 }
 
 void Buffer::prependInt8(int8_t x) {
-	prepend(sizeof(x), (char*)&x);
+	prepend<int8_t>(x);
 }
 
 void Buffer::prepend(size_t len, const void* d) {
 	Piece* first = front();
 	assert(first);
-	assert(len <= first->off);
+	if (len > first->off || isPieceShared(first)) {
+		assert(len <= kPieceCapacity);
+		first = newPiece();
+		first->off = kPieceCapacity;
+		first->next = head_;
+		head_ = first;
+		size_++;
+	}
 	first->off -= len;
 	memcpy(first->data + first->off, (char*)d, len);
 	first->len += len;
@@ -56,42 +62,39 @@ void Buffer::prepend(size_t len, const void* d) {
 }
 
 int32_t Buffer::peekInt32() const {
-	assert(length() >= sizeof(int32_t));
-	int32_t v;
-	peek(v);
-	return ntohl(v);
+	return peek<int32_t>();
 }
 
 int16_t Buffer::peekInt16() const {
-	assert(length() >= sizeof(int16_t));
-	int16_t v;
-	peek(v);
-	return ntohs(v);
+	return peek<int16_t>();
 }
 
 int8_t Buffer::peekInt8() const {
-	assert(length() >= sizeof(int8_t));
-	int8_t v;
-	peek(v);
-	return v;
+	return peek<int8_t>();
 }
 
 int32_t Buffer::readInt32() {
-	int32_t v;
-	read(sizeof(v), (char*)&v);
-	return ntohl(v);
+	return read<int32_t>();
 }
 
 int16_t Buffer::readInt16() {
-	int16_t v;
-	read(sizeof(v), (char*)&v);
-	return ntohs(v);
+	return read<int16_t>();
 }
 
 int8_t Buffer::readInt8() {
-	int8_t v;
-	read(sizeof(v), (char*)&v);
-	return v;
+	return read<int8_t>();
+}
+
+void Buffer::peek(size_t len, char* d) const {
+	assert(length() >= len);
+	Piece* item = front();
+	size_t left = len;
+	while (left > 0) {
+		size_t n = left < item->len ? left : item->len;
+		memcpy(d + len - left, item->data + item->off, n);
+		left -= n;
+		item = item->next;
+	}
 }
 
 void Buffer::read(size_t len, std::string& d) {
@@ -142,8 +145,7 @@ void Buffer::read(size_t len, Buffer* buf) {
 	do {
 		if (left <= first->len){
 			if (left < first->len) {
-				Piece* buf_last = newPiece();
-				memcpy(buf_last->data, first->data + first->off, left);
+				Piece* buf_last = sharePiece(first);
 				buf_last->len = left;
 				buf->push(buf_last);
 				first->off += left;
@@ -155,6 +157,7 @@ void Buffer::read(size_t len, Buffer* buf) {
 			break;
 		}
 		else {
+			left -= first->len;
 			buf->push(pop());
 			first = front();
 		}
@@ -163,18 +166,42 @@ void Buffer::read(size_t len, Buffer* buf) {
 	length_ -= len;
 }
 
+void Buffer::slice(size_t offset, size_t len, Buffer* buf) const {
+	assert(offset + len <= length());
+	Piece* item = front();
+	while (item && offset >= item->len) {
+		offset -= item->len;
+		item = item->next;
+	}
+
+	size_t left = len;
+	while (left > 0) {
+		assert(item);
+		size_t n = item->len - offset;
+		if (n > left) {
+			n = left;
+		}
+		Piece* view = sharePiece(item);
+		view->off += offset;
+		view->len = n;
+		buf->push(view);
+		left -= n;
+		offset = 0;
+		item = item->next;
+	}
+	buf->length_ += len;
+}
+
 void Buffer::writeInt32(int32_t x) {
-	int32_t v = htonl(x);
-	write(sizeof(v), (char*)&v);
+	write<int32_t>(x);
 }
 
 void Buffer::writeInt16(int16_t x) {
-	int16_t v = htons(x);
-	write(sizeof(v), (char*)&v);
+	write<int16_t>(x);
 }
 
 void Buffer::writeInt8(int8_t x) {
-	write(sizeof(x), (char*)&x);
+	write<int8_t>(x);
 }
 
 void Buffer::write(const std::string& d) {
@@ -182,15 +209,15 @@ void Buffer::write(const std::string& d) {
 }
 
 void Buffer::write(size_t len, const char* d) {
-	Piece* last = back();
-	if (!last || last->off + last->len == sizeof(last->data)){
+	Piece* last = writableBack();
+	if (!last){
 		push(newPiece());
 		last = back();
 	}
 
 	size_t left = len;
 	do {
-		size_t unwrite = sizeof(last->data) - last->off - last->len;
+		size_t unwrite = kPieceCapacity - last->off - last->len;
 		if (left <= unwrite) {
 			memcpy(last->data + last->off + last->len, d + len - left, left);
 			last->len += left;
@@ -208,6 +235,48 @@ void Buffer::write(size_t len, const char* d) {
 	length_ += len;
 }
 
+void Buffer::writeVarint(uint64_t x) {
+	Piece* last = writableBack();
+	if (last && (size_t)(kPieceCapacity - last->off - last->len) >= kMaxVarintLen) {
+		size_t n = internal::encodeVarint(x, last->data + last->off + last->len);
+		last->len += n;
+		length_ += n;
+	}
+	else {
+		char tmp[kMaxVarintLen];
+		size_t n = internal::encodeVarint(x, tmp);
+		write(n, tmp);
+	}
+}
+
+Buffer::VarintStatus Buffer::readVarint(uint64_t* x) {
+	uint64_t v = 0;
+	size_t n = 0;
+	for (Piece* item = front(); item && n < kMaxVarintLen; item = item->next) {
+		const uint8_t* p = (const uint8_t*)item->data + item->off;
+		const uint8_t* end = p + item->len;
+		for (; p < end && n < kMaxVarintLen; ++p) {
+			v |= (uint64_t)(*p & 0x7f) << (7 * n);
+			++n;
+			if (!(*p & 0x80)) {
+				*x = v;
+				skip(n);
+				return kVarintOk;
+			}
+		}
+	}
+	return n < kMaxVarintLen ? kVarintIncomplete : kVarintMalformed;
+}
+
+Buffer::VarintStatus Buffer::readVarintZigZag(int64_t* x) {
+	uint64_t v;
+	VarintStatus status = readVarint(&v);
+	if (status == kVarintOk) {
+		*x = internal::zigZagDecode(v);
+	}
+	return status;
+}
+
 void Buffer::skip(size_t len) {
 	assert(length() >= len);
 	Piece* first = front();
@@ -232,6 +301,56 @@ void Buffer::skip(size_t len) {
 	length_ -= len;
 }
 
+void Buffer::truncate(size_t len) {
+	assert(length() >= len);
+	if (len == 0) {
+		clear();
+		return;
+	}
+	Piece* last = front();
+	size_t kept = last->len;
+	while (kept < len) {
+		last = last->next;
+		kept += last->len;
+	}
+	// only this view is shortened, shared bytes stay untouched
+	last->len -= kept - len;
+	Piece* drop = last->next;
+	last->next = nullptr;
+	tail_ = last;
+	while (drop) {
+		Piece* next = drop->next;
+		deletePiece(drop);
+		size_--;
+		drop = next;
+	}
+	length_ = len;
+}
+
+size_t Buffer::findDelimiter(char delim, size_t from) const {
+	return findDelimiter(&delim, 1, from);
+}
+
+size_t Buffer::findDelimiter(const char* delim, size_t len, size_t from) const {
+	assert(len > 0);
+	if (from + len > length()) {
+		return npos;
+	}
+
+	Piece* first = front();
+	size_t idx = first->off;
+	size_t left = from;
+	while (left >= first->len && left > 0) {
+		left -= first->len;
+		first = first->next;
+		idx = first->off;
+	}
+	idx += left;
+
+	size_t found = searchPieces(first, idx, delim, len);
+	return found == kSearchNotFound ? npos : from + found;
+}
+
 Piece* Buffer::moveToQueueHead() {
 	Piece* queue_head = head_;
 
@@ -245,7 +364,7 @@ Piece* Buffer::moveToQueueHead() {
 
 void Buffer::clear() {
 	while (!empty()) {
-		delete pop();
+		deletePiece(pop());
 	}
 	length_ = 0;
 }
@@ -1,12 +1,16 @@
 #pragma once
 #include <netpp/net/piece/queue.h>
+#include <netpp/net/piece/piece_allocator.h>
+#include <netpp/net/byte_order.h>
 #include <string>
 #include <boost/asio.hpp>
 
 namespace netpp{
-struct Piece;
+const size_t kMaxVarintLen = 10;
+
 class Buffer : protected Queue<Piece>
 {
+	friend class BufferCursor;
 public:
 	explicit Buffer();
 	~Buffer();
@@ -31,47 +35,123 @@ public:
 	void read(size_t len, std::string& d);	
 	void read(size_t len, char* d);	
 	void readAll(std::string& d);
+	// Moves len bytes into buf, a piece split at the boundary is shared, not copied.
 	void read(size_t len, Buffer* empty_buf);
+	// Appends views of [offset, offset + len) to buf without consuming them.
+	void slice(size_t offset, size_t len, Buffer* buf) const;
 
 	void writeInt32(int32_t x);
 	void writeInt16(int16_t x);
 	void writeInt8(int8_t x);
 	void write(const std::string& d);
+	void write(const char* s) { write(strlen(s), s); }
 	void write(size_t len, const char* d);	
 
+	// Fixed width values of any arithmetic type, big endian by default.
+	template<typename T, Endian E = kBigEndian>
+	T peek() const;
+	template<typename T, Endian E = kBigEndian>
+	T read();
+	template<typename T, Endian E = kBigEndian>
+	void write(T x);
+	template<typename T, Endian E = kBigEndian>
+	void prepend(T x);
+
+	// LEB128 varints, zigzag for signed values. read consumes the varint only
+	// on kVarintOk. kVarintIncomplete means wait for more bytes, while
+	// kVarintMalformed (kMaxVarintLen bytes without an end) never resolves,
+	// the stream should be dropped.
+	enum VarintStatus
+	{
+		kVarintOk,
+		kVarintIncomplete,
+		kVarintMalformed,
+	};
+	void writeVarint(uint64_t x);
+	void writeVarintZigZag(int64_t x) { writeVarint(internal::zigZagEncode(x)); }
+	VarintStatus readVarint(uint64_t* x);
+	VarintStatus readVarintZigZag(int64_t* x);
+
 	void skip(size_t len);
+	// Drops everything after the first len bytes, e.g. a half-written record.
+	void truncate(size_t len);
+
+	// Offset of the first delimiter at or after from, npos when not found.
+	// Matches may straddle pieces.
+	static const size_t npos = static_cast<size_t>(-1);
+	size_t findDelimiter(char delim, size_t from = 0) const;
+	size_t findDelimiter(const char* delim, size_t len, size_t from = 0) const;
+	size_t findDelimiter(const std::string& delim, size_t from = 0) const {
+		return findDelimiter(delim.data(), delim.size(), from); }
+	size_t findCRLF(size_t from = 0) const {
+		return findDelimiter("\r\n", 2, from); }
+	size_t findEOL(size_t from = 0) const {
+		return findDelimiter('\n', from); }
 
 	Piece* moveToQueueHead();
 
 	void clear();
 
 protected:
-	template<typename T>
-	void peek(T& t) const {
-		assert(length() >= sizeof(t));
-
-		Piece* cur = front();
-		if (sizeof(T) <= cur->len) {
-			memcpy(&t, cur->data + cur->off, sizeof(T));
-		}
-		else {
-			memcpy(&t, cur->data + cur->off, cur->len);			
-			size_t left = sizeof(T) - cur->len;
-			cur = cur->next;
-			do {
-				if (left <= cur->len) {
-					memcpy(&t + sizeof(T) - left, cur->data + cur->off, left);
-					break;
-				}
-				else {
-					memcpy(&t + sizeof(T) - left, cur->data + cur->off, cur->len);
-					left -= cur->len;
-					cur = cur->next;
-				}
-			} while (true);
+	void peek(size_t len, char* d) const;
+	// tail piece when bytes can still be appended to it in place
+	Piece* writableBack() const {
+		Piece* last = back();
+		if (last && last->off + last->len < kPieceCapacity && !isPieceShared(last)) {
+			return last;
 		}
+		return nullptr;
 	}
 
 	size_t length_;
 };
+
+template<typename T, Endian E>
+T Buffer::peek() const {
+	assert(length() >= sizeof(T));
+	Piece* first = front();
+	if (first->len >= sizeof(T)) {
+		return internal::decodeValue<T, E>(first->data + first->off);
+	}
+	char tmp[sizeof(T)];
+	peek(sizeof(T), tmp);
+	return internal::decodeValue<T, E>(tmp);
+}
+
+template<typename T, Endian E>
+T Buffer::read() {
+	assert(length() >= sizeof(T));
+	Piece* first = front();
+	if (first->len > sizeof(T)) {
+		T x = internal::decodeValue<T, E>(first->data + first->off);
+		first->off += sizeof(T);
+		first->len -= sizeof(T);
+		length_ -= sizeof(T);
+		return x;
+	}
+	char tmp[sizeof(T)];
+	read(sizeof(T), tmp);
+	return internal::decodeValue<T, E>(tmp);
+}
+
+template<typename T, Endian E>
+void Buffer::write(T x) {
+	Piece* last = writableBack();
+	if (last && (size_t)(kPieceCapacity - last->off - last->len) >= sizeof(T)) {
+		internal::encodeValue<T, E>(x, last->data + last->off + last->len);
+		last->len += sizeof(T);
+		length_ += sizeof(T);
+		return;
+	}
+	char tmp[sizeof(T)];
+	internal::encodeValue<T, E>(x, tmp);
+	write(sizeof(T), tmp);
+}
+
+template<typename T, Endian E>
+void Buffer::prepend(T x) {
+	char tmp[sizeof(T)];
+	internal::encodeValue<T, E>(x, tmp);
+	prepend(sizeof(T), tmp);
+}
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include <netpp/net/buffer_cursor.h>
+#include <netpp/net/piece/piece_search.h>
+
+namespace netpp {
+BufferCursor::BufferCursor(Buffer* buf)
+	: buffer_(buf)
+	, cur_(buf->front())
+	, idx_(0)
+	, pos_(0) {
+	while (cur_ && cur_->len == 0) {
+		cur_ = cur_->next;
+	}
+	if (cur_) {
+		idx_ = cur_->off;
+	}
+}
+
+void BufferCursor::advance(size_t len) {
+	assert(len <= remaining());
+	pos_ += len;
+	while (cur_) {
+		size_t left = cur_->off + cur_->len - idx_;
+		if (len < left) {
+			idx_ += len;
+			return;
+		}
+		len -= left;
+		cur_ = cur_->next;
+		while (cur_ && cur_->len == 0) {
+			cur_ = cur_->next;
+		}
+		if (cur_) {
+			idx_ = cur_->off;
+		}
+	}
+}
+
+size_t BufferCursor::find(char c) const {
+	return find(&c, 1);
+}
+
+size_t BufferCursor::find(const char* seq, size_t len) const {
+	assert(len > 0);
+	if (!cur_ || len > remaining()) {
+		return npos;
+	}
+	size_t found = searchPieces(cur_, idx_, seq, len);
+	return found == kSearchNotFound ? npos : found;
+}
+
+const char* BufferCursor::peekContiguous(size_t len) {
+	assert(len <= remaining());
+	if (len <= contiguousLength()) {
+		return data();
+	}
+
+	scratch_.resize(len);
+	char* out = &scratch_[0];
+	const Piece* piece = cur_;
+	size_t idx = idx_;
+	size_t left = len;
+	while (left > 0) {
+		size_t avail = piece->off + piece->len - idx;
+		size_t n = left < avail ? left : avail;
+		memcpy(out, piece->data + idx, n);
+		out += n;
+		left -= n;
+		piece = piece->next;
+		if (piece) {
+			idx = piece->off;
+		}
+	}
+	return scratch_.data();
+}
+
+void BufferCursor::consume(size_t len) {
+	assert(len <= pos_);
+	if (len > 0) {
+		buffer_->skip(len);
+		pos_ -= len;
+	}
+}
+}
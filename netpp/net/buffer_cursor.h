@@ -0,0 +1,51 @@
+#pragma once
+#include <netpp/net/buffer.h>
+#include <netpp/net/piece/piece_allocator.h>
+#include <string>
+
+namespace netpp {
+// Forward, non-consuming view over a Buffer's piece chain. Any write to the
+// buffer, or a read/skip past the cursor, invalidates it.
+class BufferCursor
+{
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+
+	explicit BufferCursor(Buffer* buf);
+
+	// bytes passed since the front of the buffer
+	size_t position() const { return pos_; }
+	size_t remaining() const { return buffer_->length() - pos_; }
+	bool atEnd() const { return cur_ == nullptr; }
+
+	char current() const {
+		assert(cur_);
+		return cur_->data[idx_]; }
+	void advance(size_t len);
+
+	// contiguous bytes at the cursor inside the current piece
+	const char* data() const { return cur_ ? cur_->data + idx_ : nullptr; }
+	size_t contiguousLength() const { return cur_ ? cur_->off + cur_->len - idx_ : 0; }
+
+	// Offsets are relative to the cursor, npos when not found. The cursor does not move.
+	size_t find(char c) const;
+	size_t find(const char* seq, size_t len) const;
+	size_t find(const std::string& seq) const { return find(seq.data(), seq.size()); }
+
+	// Pointer to len bytes at the cursor, straight into the piece when they are
+	// contiguous, otherwise copied into a scratch area valid until the next call.
+	const char* peekContiguous(size_t len);
+
+	// Drop the first len bytes (len <= position()) from the buffer, the cursor
+	// keeps pointing at the same byte.
+	void consume(size_t len);
+	void consume() { consume(pos_); }
+
+private:
+	Buffer* buffer_;
+	Piece* cur_;
+	size_t idx_;
+	size_t pos_;
+	std::string scratch_;
+};
+}
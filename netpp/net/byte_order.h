@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <boost/predef/other/endian.h>
+#include <boost/type_traits/is_arithmetic.hpp>
+#include <boost/static_assert.hpp>
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace netpp {
+enum Endian
+{
+	kBigEndian,
+	kLittleEndian,
+#if BOOST_ENDIAN_BIG_BYTE
+	kHostEndian = kBigEndian,
+#else
+	kHostEndian = kLittleEndian,
+#endif
+};
+
+namespace internal {
+template<size_t N> struct UintOfSize;
+template<> struct UintOfSize<1> { typedef uint8_t type; };
+template<> struct UintOfSize<2> { typedef uint16_t type; };
+template<> struct UintOfSize<4> { typedef uint32_t type; };
+template<> struct UintOfSize<8> { typedef uint64_t type; };
+
+inline uint8_t byteSwap(uint8_t x) { return x; }
+#ifdef _MSC_VER
+inline uint16_t byteSwap(uint16_t x) { return _byteswap_ushort(x); }
+inline uint32_t byteSwap(uint32_t x) { return _byteswap_ulong(x); }
+inline uint64_t byteSwap(uint64_t x) { return _byteswap_uint64(x); }
+#else
+inline uint16_t byteSwap(uint16_t x) { return __builtin_bswap16(x); }
+inline uint32_t byteSwap(uint32_t x) { return __builtin_bswap32(x); }
+inline uint64_t byteSwap(uint64_t x) { return __builtin_bswap64(x); }
+#endif
+
+// Swapping is decided by template arguments only, so each instantiation
+// compiles down to a load/store plus at most one bswap.
+template<typename T, Endian E>
+inline void encodeValue(T x, char* out) {
+	BOOST_STATIC_ASSERT((boost::is_arithmetic<T>::value));
+	typedef typename UintOfSize<sizeof(T)>::type U;
+	U u;
+	memcpy(&u, &x, sizeof(T));
+	if (E != kHostEndian) {
+		u = byteSwap(u);
+	}
+	memcpy(out, &u, sizeof(T));
+}
+
+template<typename T, Endian E>
+inline T decodeValue(const char* in) {
+	BOOST_STATIC_ASSERT((boost::is_arithmetic<T>::value));
+	typedef typename UintOfSize<sizeof(T)>::type U;
+	U u;
+	memcpy(&u, in, sizeof(T));
+	if (E != kHostEndian) {
+		u = byteSwap(u);
+	}
+	T x;
+	memcpy(&x, &u, sizeof(T));
+	return x;
+}
+
+inline size_t encodeVarint(uint64_t x, char* out) {
+	size_t n = 0;
+	while (x >= 0x80) {
+		out[n++] = (char)(x | 0x80);
+		x >>= 7;
+	}
+	out[n++] = (char)x;
+	return n;
+}
+
+inline uint64_t zigZagEncode(int64_t x) {
+	return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+inline int64_t zigZagDecode(uint64_t x) {
+	return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+}
+}
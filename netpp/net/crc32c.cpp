@@ -0,0 +1,136 @@
+#include <netpp/net/crc32c.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NETPP_CRC_X86 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NETPP_TARGET_SSE42
+#else
+#define NETPP_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+namespace netpp {
+namespace {
+typedef uint32_t (*Crc32cFn)(uint32_t, const uint8_t*, size_t);
+
+struct Crc32cKernel
+{
+	Crc32cFn fn;
+	const char* name;
+};
+
+const uint32_t kCrc32cPoly = 0x82f63b78;
+
+// t[k][b] is the crc of byte b followed by k zero bytes
+struct SlicingTables
+{
+	uint32_t t[8][256];
+
+	SlicingTables() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int j = 0; j < 8; j++) {
+				crc = (crc >> 1) ^ (kCrc32cPoly & (0 - (crc & 1)));
+			}
+			t[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; i++) {
+			for (int k = 1; k < 8; k++) {
+				t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+			}
+		}
+	}
+};
+
+const SlicingTables& slicingTables() {
+	static const SlicingTables tables;
+	return tables;
+}
+
+inline uint32_t loadLE32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t crc32cSlicing8(uint32_t crc, const uint8_t* p, size_t len) {
+	const uint32_t (*t)[256] = slicingTables().t;
+	for (; len > 0 && ((uintptr_t)p & 7); --len) {
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	for (; len >= 8; p += 8, len -= 8) {
+		uint32_t lo = crc ^ loadLE32(p);
+		uint32_t hi = loadLE32(p + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for (; len > 0; --len) {
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#ifdef NETPP_CRC_X86
+bool cpuHasSSE42() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+NETPP_TARGET_SSE42
+uint32_t crc32cSSE42(uint32_t crc, const uint8_t* p, size_t len) {
+	for (; len > 0 && ((uintptr_t)p & 7); --len) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+#if defined(_M_X64) || defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for (; len >= 4; p += 4, len -= 4) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u32(crc, v);
+	}
+	for (; len > 0; --len) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+Crc32cKernel selectKernel() {
+	Crc32cKernel k = { crc32cSlicing8, "slicing8" };
+#ifdef NETPP_CRC_X86
+	if (cpuHasSSE42()) {
+		k.fn = crc32cSSE42;
+		k.name = "sse4.2";
+	}
+#endif
+	return k;
+}
+
+const Crc32cKernel& kernel() {
+	static const Crc32cKernel k = selectKernel();
+	return k;
+}
+}
+
+uint32_t crc32cExtend(uint32_t crc, const void* data, size_t len) {
+	return ~kernel().fn(~crc, static_cast<const uint8_t*>(data), len);
+}
+
+const char* crc32cKernelName() {
+	return kernel().name;
+}
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace netpp {
+	// CRC32C (Castagnoli). The kernel is picked once at runtime: the SSE4.2
+	// crc32 instruction, then slicing-by-8 tables.
+	// crc32cExtend continues crc over more data, a new checksum starts from 0.
+	uint32_t crc32cExtend(uint32_t crc, const void* data, size_t len);
+	inline uint32_t crc32c(const void* data, size_t len) { return crc32cExtend(0, data, len); }
+	const char* crc32cKernelName();
+}
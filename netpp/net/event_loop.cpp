@@ -45,20 +45,18 @@ DealTimerPtr EventLoop::runEvery(double delay_ms, Functor&& f) {
 DealTimerPtr EventLoop::runAfter(const boost::posix_time::time_duration& delay, Functor&& f) {
 	DealTimerPtr timer(new deadline_timer(*io_service_));
 	timer->expires_from_now(delay);
-	timer->async_wait([timer, f](const boost::system::error_code&){ f(); });
+	timer->async_wait([timer, f](const boost::system::error_code& ec) {
+		if (ec != boost::asio::error::operation_aborted) {
+			f();
+		}
+	});
 	return timer;
 }
 
 DealTimerPtr EventLoop::runEvery(const boost::posix_time::time_duration& delay, Functor&& f) {
-	std::function<void(DealTimerPtr, boost::posix_time::time_duration, Functor)> callback;
-	callback = [=](DealTimerPtr timer, boost::posix_time::time_duration delay, Functor f) {
-		f();
-		timer->expires_from_now(delay);
-		timer->async_wait(std::bind(callback, timer, std::move(delay), std::move(f)));
-	};
 	DealTimerPtr timer(new deadline_timer(*io_service_));	
 	timer->expires_from_now(delay);
-	timer->async_wait(std::bind(callback, timer, std::move(delay), std::move(f)));
+	timer->async_wait(std::bind(&EventLoop::execTimerEvery, this, timer, delay, std::move(f), std::placeholders::_1));
 	return timer;
 }
 
@@ -70,9 +68,12 @@ void EventLoop::queueInLoop(Functor&& handler) {
 	io_service_->post(handler);
 }
 
-void EventLoop::execTimerEvery(DealTimerPtr timer, boost::posix_time::time_duration delay, Functor f) {
+void EventLoop::execTimerEvery(DealTimerPtr timer, boost::posix_time::time_duration delay, Functor f, const boost::system::error_code& ec) {
+	if (ec == boost::asio::error::operation_aborted) {
+		return;
+	}
 	f();
 	timer->expires_from_now(delay);
-	timer->async_wait(std::bind(&EventLoop::execTimerEvery, this, timer, std::move(delay), std::move(f)));
+	timer->async_wait(std::bind(&EventLoop::execTimerEvery, this, timer, std::move(delay), std::move(f), std::placeholders::_1));
 }
 }
\ No newline at end of file
@@ -33,7 +33,7 @@ public:
 	bool isInLoopThread() const { return tid_ == std::this_thread::get_id(); }
 
 private:
-	void execTimerEvery(DealTimerPtr timer, boost::posix_time::time_duration delay, Functor f);
+	void execTimerEvery(DealTimerPtr timer, boost::posix_time::time_duration delay, Functor f, const boost::system::error_code& ec);
 
 private:
 	bool is_own_service_;
@@ -32,10 +32,7 @@ void EventLoopThread::stop(bool wait_thread_exit) {
 	event_loop_->stop();
 
 	if (wait_thread_exit) {
-		while (!isStopped()) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-		}
-
+		// run() marks the thread stopped right before it returns
 		join();
 	}
 }
@@ -20,15 +20,14 @@ bool EventLoopThreadPool::start(bool wait_thread_started) {
 	}
 
 	std::shared_ptr<std::atomic<uint32_t>> started_count(new std::atomic<uint32_t>(0));
-	std::shared_ptr<std::atomic<uint32_t>> exited_count(new std::atomic<uint32_t>(0));
 	for (uint32_t i = 0; i < thread_num_; ++i) {
 		auto prefn = [this, started_count]() {
 			this->onThreadStarted(started_count->fetch_add(1) + 1);
 			return EventLoopThread::kOK;
 		};
 
-		auto postfn = [this, exited_count]() {
-			this->onThreadExited(exited_count->fetch_add(1) + 1);
+		auto postfn = [this]() {
+			this->onThreadExited();
 			return EventLoopThread::kOK;
 		};
 
@@ -44,10 +43,8 @@ bool EventLoopThreadPool::start(bool wait_thread_started) {
 	}
 	
 	if (wait_thread_started) {
-		while (!isRunning()) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-		}
-		assert(status_.load() == kRunning);
+		std::unique_lock<std::mutex> lock(mutex_);
+		cond_.wait(lock, [this]() { return isRunning(); });
 	}
 
 	return true;
@@ -93,43 +90,57 @@ void EventLoopThreadPool::stop(bool wait_thread_exit, DoneCallback fn) {
 		return;
 	}
 
-	stopped_cb_ = fn;
+	bool exited = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		// an earlier stop already ended the threads, nothing will call back
+		exited = exited_ == thread_num_;
+		if (!exited && fn) {
+			stopped_cb_ = fn;
+		}
+	}
+	if (exited) {
+		status_.store(kStopped);
+		if (fn) {
+			fn();
+		}
+		return;
+	}
 
 	for (auto &t : threads_) {
 		t->stop();
 	}
 
-	auto is_stopped_fn = [this]() {
-		for (auto &t : this->threads_) {
-			if (!t->isStopped()) {
-				return false;
-			}
-		}
-		return true;
-	};
-
-	if (thread_num_ > 0 && wait_thread_exit) {
-		while (!is_stopped_fn()) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-		}
+	if (wait_thread_exit) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		cond_.wait(lock, [this]() { return exited_ == thread_num_; });
 	}
-
 	status_.store(kStopped);
 }
 
 void EventLoopThreadPool::onThreadStarted(uint32_t count) {
 	if (count == thread_num_) {
-		status_.store(kRunning);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			status_.store(kRunning);
+		}
+		cond_.notify_all();
 	}
 }
 
-void EventLoopThreadPool::onThreadExited(uint32_t count) {
-	if (count == thread_num_) {
-		status_.store(kStopped);
-		if (stopped_cb_) {
-			stopped_cb_();
-			stopped_cb_ = DoneCallback();
+void EventLoopThreadPool::onThreadExited() {
+	DoneCallback cb;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (++exited_ < thread_num_) {
+			return;
 		}
+		status_.store(kStopped);
+		cb.swap(stopped_cb_);
+	}
+	cond_.notify_all();
+	if (cb) {
+		cb();
 	}
 }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <netpp/net/event_loop_thread.h>
+#include <condition_variable>
 
 namespace netpp {
 class EventLoopThreadPool : public ServerStatus, public boost::noncopyable
@@ -21,7 +22,7 @@ public:
 private:
 	void stop(bool wait_thread_exit, DoneCallback fn);
 	void onThreadStarted(uint32_t count);
-	void onThreadExited(uint32_t count);
+	void onThreadExited();
 
 private:
 	EventLoop* base_loop_;
@@ -29,7 +30,11 @@ private:
 	uint32_t thread_num_ = 0;
 	std::atomic<int64_t> next_ = { 0 };
 
+	// stopped_cb_ and exited_ are guarded by mutex_
 	DoneCallback stopped_cb_;
+	uint32_t exited_ = 0;
+	std::mutex mutex_;
+	std::condition_variable cond_;
 
 	typedef std::shared_ptr<EventLoopThread> EventLoopThreadPtr;
 	std::vector<EventLoopThreadPtr> threads_;
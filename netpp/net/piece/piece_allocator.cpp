@@ -1,14 +1,59 @@
-#pragma once
 #include <netpp/net/piece/piece_allocator.h>
+#include <netpp/net/piece/piece_arena.h>
 #include <netpp/net/piece/queue.h>
+#include <atomic>
 #include <mutex>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace netpp {
+struct PieceSlab
+{
+	PieceSlab* prev;
+	PieceSlab* next;
+	char* payload;
+	Queue<Piece> free_pieces;
+	Piece pieces[kPiecesPerSlab];
+	// views per payload block, pieces[i] is handed back once refs[i] drops to 0
+	std::atomic<uint32_t> refs[kPiecesPerSlab];
+};
+
+inline uint32_t blockIndex(const Piece* item) {
+	return (uint32_t)((item->data - item->slab->payload) / kPieceCapacity);
+}
+
+namespace {
+char* allocSlabData(size_t size) {
+#ifdef _WIN32
+	return (char*)::VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? nullptr : (char*)p;
+#endif
+}
+
+void freeSlabData(char* data, size_t size) {
+#ifdef _WIN32
+	::VirtualFree(data, 0, MEM_RELEASE);
+#else
+	::munmap(data, size);
+#endif
+}
+}
+
 class PiecePool
 {
 public:
 	PiecePool()
-		: using_count_(0) {
+		: partial_(nullptr)
+		, idle_(nullptr)
+		, using_count_(0)
+		, free_count_(0)
+		, slab_count_(0) {
 	}
 
 	~PiecePool() {
@@ -18,71 +63,225 @@ public:
 	Piece* newPiece() {
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			using_count_++;
-
-			Piece* item = queue_.pop();
-			if (item) {
-				item->next = nullptr;
-				item->off = 0;
-				item->len = 0;
-				return item;
+			if (partial_) {
+				return takePiece(partial_);
+			}
+			if (idle_) {
+				PieceSlab* slab = idle_;
+				unlinkSlab(&idle_, slab);
+				linkSlab(&partial_, slab);
+				return takePiece(slab);
 			}
 		}
-		
-		Piece* item = new Piece;
-		item->next = nullptr;
-		item->off = 0;
-		item->len = 0;
-		return item;
+
+		PieceSlab* slab = newSlab();
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		free_count_ += kPiecesPerSlab;
+		slab_count_++;
+		linkSlab(&partial_, slab);
+		return takePiece(slab);
 	}
 	
+	Piece* sharePiece(Piece* item) {
+		Piece* view = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			view = view_headers_.pop();
+		}
+		if (!view) {
+			view = new Piece;
+		}
+
+		view->next = nullptr;
+		view->data = item->data;
+		view->slab = item->slab;
+		view->off = item->off;
+		view->len = item->len;
+		item->slab->refs[blockIndex(item)].fetch_add(1, std::memory_order_relaxed);
+		return view;
+	}
+
 	void deletePiece(Piece* item) {
-#define MAX_DELETE_ONCE 8
-#define BASE_CACHE_COUNT 8
+#define BASE_CACHE_COUNT kPiecesPerSlab
+#define MAX_CACHE_VIEW_COUNT 1024
 
-		Piece* del_array[MAX_DELETE_ONCE];
-		uint32_t del_count = 0;
-		
+		PieceSlab* slab = item->slab;
+		uint32_t index = blockIndex(item);
+		if (item != &slab->pieces[index]) {
+			deleteViewHeader(item);
+			item = &slab->pieces[index];
+		}
+
+		// a sole owner skips the atomic read-modify-write
+		std::atomic<uint32_t>& refs = slab->refs[index];
+		if (refs.load(std::memory_order_acquire) != 1
+			&& refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+			return;
+		}
+
+		PieceSlab* release = nullptr;
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
 			using_count_--;
-			
-			uint32_t limit = using_count_ + BASE_CACHE_COUNT;
-			if (queue_.size() < limit) {
-				queue_.push(item);
+			free_count_++;
+
+			if (slab->free_pieces.empty()) {
+				linkSlab(&partial_, slab);
 			}
-			else {				
-				del_count = queue_.size() - limit + 1;
-				if (del_count > MAX_DELETE_ONCE) {
-					del_count = MAX_DELETE_ONCE;
-				}
-				del_array[0] = item;
-				for (uint32_t i = 1; i < del_count; ++i){
-					del_array[i] = queue_.pop();
-				}
+			slab->free_pieces.push(item);
+			if (slab->free_pieces.size() == kPiecesPerSlab) {
+				unlinkSlab(&partial_, slab);
+				linkSlab(&idle_, slab);
 			}
-		}
 
-		if (del_count > 0) {
-			for (uint32_t i = 0; i < del_count; ++i) {
-				delete del_array[i];
+			// only a fully idle slab can be given back, keep a cache
+			// proportional to the pieces still in use.
+			uint32_t limit = using_count_ + BASE_CACHE_COUNT;
+			if (idle_ && free_count_ - kPiecesPerSlab >= limit) {
+				release = idle_;
+				unlinkSlab(&idle_, release);
+				free_count_ -= kPiecesPerSlab;
+				slab_count_--;
 			}
 		}
+
+		if (release) {
+			deleteSlab(release);
+		}
 	}
-	
+
+	bool enableArena(const PieceArenaOptions& options) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		assert(slab_count_ == 0);
+		if (slab_count_ > 0 || arena_.isReserved()) {
+			return false;
+		}
+		return arena_.reserve(options.reserve_bytes, options.memory_limit, options.huge_pages);
+	}
+
+	PiecePoolStats stats() {
+		PiecePoolStats s;
+		std::unique_lock<std::mutex> lock(mutex_);
+		s.arena = arena_.isReserved();
+		s.huge_pages = arena_.hugePages();
+		s.reserved_bytes = arena_.reservedBytes();
+		s.resident_bytes = (size_t)slab_count_ * kSlabDataSize + arena_.idleBytes();
+		s.used_bytes = (size_t)using_count_ * kPieceCapacity;
+		s.free_bytes = s.resident_bytes - s.used_bytes;
+		s.slab_count = slab_count_;
+		return s;
+	}
+
 private:
+	Piece* takePiece(PieceSlab* slab) {
+		Piece* item = slab->free_pieces.pop();
+		if (slab->free_pieces.empty()) {
+			unlinkSlab(&partial_, slab);
+		}
+		using_count_++;
+		free_count_--;
+		slab->refs[item - slab->pieces].store(1, std::memory_order_relaxed);
+
+		item->next = nullptr;
+		item->off = 0;
+		item->len = 0;
+		return item;
+	}
+
+	void deleteViewHeader(Piece* view) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (view_headers_.size() < MAX_CACHE_VIEW_COUNT) {
+				view_headers_.push(view);
+				return;
+			}
+		}
+		delete view;
+	}
+
+	static void linkSlab(PieceSlab** head, PieceSlab* slab) {
+		slab->prev = nullptr;
+		slab->next = *head;
+		if (*head) {
+			(*head)->prev = slab;
+		}
+		*head = slab;
+	}
+
+	static void unlinkSlab(PieceSlab** head, PieceSlab* slab) {
+		if (slab->prev) {
+			slab->prev->next = slab->next;
+		}
+		else {
+			*head = slab->next;
+		}
+		if (slab->next) {
+			slab->next->prev = slab->prev;
+		}
+		slab->prev = nullptr;
+		slab->next = nullptr;
+	}
+
+	PieceSlab* newSlab() {
+		char* payload = nullptr;
+		if (arena_.isReserved()) {
+			payload = arena_.allocSlabData();
+		}
+		if (!payload) {
+			payload = allocSlabData(kSlabDataSize);
+		}
+		if (!payload) {
+			throw std::bad_alloc();
+		}
+
+		PieceSlab* slab = new PieceSlab;
+		slab->prev = nullptr;
+		slab->next = nullptr;
+		slab->payload = payload;
+		for (uint32_t i = 0; i < kPiecesPerSlab; ++i) {
+			Piece* item = &slab->pieces[i];
+			item->data = payload + (size_t)i * kPieceCapacity;
+			item->slab = slab;
+			slab->refs[i].store(0, std::memory_order_relaxed);
+			slab->free_pieces.push(item);
+		}
+		return slab;
+	}
+
+	void deleteSlab(PieceSlab* slab) {
+		if (arena_.contains(slab->payload)) {
+			arena_.freeSlabData(slab->payload);
+		}
+		else {
+			freeSlabData(slab->payload, kSlabDataSize);
+		}
+		delete slab;
+	}
+
 	void clear()
 	{
 		std::unique_lock<std::mutex> lock(mutex_);
 
-		while (!queue_.empty()) {
-			delete queue_.pop();
+		while (idle_) {
+			PieceSlab* slab = idle_;
+			unlinkSlab(&idle_, slab);
+			slab_count_--;
+			deleteSlab(slab);
+		}
+		while (!view_headers_.empty()) {
+			delete view_headers_.pop();
 		}
 	}
 	
 	std::mutex mutex_;
-	Queue<Piece> queue_;
+	PieceSlab* partial_;
+	PieceSlab* idle_;
 	uint32_t using_count_;
+	uint32_t free_count_;
+	uint32_t slab_count_;
+	Queue<Piece> view_headers_;
+	PieceArena arena_;
 };
 
 PiecePool pool_;
@@ -94,4 +293,20 @@ Piece* newPiece() {
 void deletePiece(Piece* item) {
 	pool_.deletePiece(item);
 }
-}
\ No newline at end of file
+
+Piece* sharePiece(Piece* item) {
+	return pool_.sharePiece(item);
+}
+
+bool isPieceShared(const Piece* item) {
+	return item->slab->refs[blockIndex(item)].load(std::memory_order_acquire) > 1;
+}
+
+bool enablePieceArena(const PieceArenaOptions& options) {
+	return pool_.enableArena(options);
+}
+
+PiecePoolStats getPiecePoolStats() {
+	return pool_.stats();
+}
+}
@@ -1,17 +1,60 @@
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
 
 namespace netpp {
 
 	const uint16_t kPieceCapacity = 1024 * 4;
+	const uint32_t kPiecesPerSlab = 64;
+	const size_t kSlabDataSize = (size_t)kPiecesPerSlab * kPieceCapacity;
+
+	struct PieceSlab;
+	// Piece headers live in a compact array inside their PieceSlab, the
+	// payload points into the slab's page-aligned data block. Several headers
+	// (views) may share one block, each with its own off/len.
 	struct Piece
 	{
 		Piece* next;
+		char* data;
+		PieceSlab* slab;
 		uint16_t off;
 		uint16_t len;
-		char data[kPieceCapacity];
+	};
+
+	struct PieceArenaOptions
+	{
+		PieceArenaOptions()
+			: reserve_bytes((size_t)1024 * 1024 * 1024)
+			, memory_limit((size_t)256 * 1024 * 1024)
+			, huge_pages(true) {
+		}
+
+		size_t reserve_bytes;	// address space reserved up front
+		size_t memory_limit;	// idle slabs are given back above this resident size
+		bool huge_pages;		// MAP_HUGETLB, falling back to MADV_HUGEPAGE
+	};
+
+	struct PiecePoolStats
+	{
+		bool arena;
+		bool huge_pages;
+		size_t reserved_bytes;
+		size_t resident_bytes;
+		size_t used_bytes;
+		size_t free_bytes;
+		uint32_t slab_count;
 	};
 
 	Piece* newPiece();
 	void deletePiece(Piece* item);
-}
\ No newline at end of file
+	// New view over the same payload, no copy. Bytes outside a view's
+	// off/len may belong to another view, so only write into a piece
+	// that is not shared.
+	Piece* sharePiece(Piece* item);
+	bool isPieceShared(const Piece* item);
+
+	// Switch the pool to arena mode, must be called before the first newPiece().
+	// Slabs fall back to the heap once the arena is exhausted.
+	bool enablePieceArena(const PieceArenaOptions& options);
+	PiecePoolStats getPiecePoolStats();
+}
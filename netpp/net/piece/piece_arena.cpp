@@ -0,0 +1,179 @@
+#include <netpp/net/piece/piece_arena.h>
+#include <assert.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace netpp {
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+PieceArena::PieceArena()
+	: map_base_(nullptr)
+	, map_size_(0)
+	, base_(nullptr)
+	, chunk_size_(kSlabDataSize)
+	, slabs_per_chunk_(1)
+	, chunk_count_(0)
+	, huge_pages_(false)
+	, memory_limit_(0)
+	, resident_bytes_(0)
+	, used_bytes_(0) {
+}
+
+PieceArena::~PieceArena() {
+	if (map_base_) {
+#ifdef _WIN32
+		::VirtualFree(map_base_, 0, MEM_RELEASE);
+#else
+		::munmap(map_base_, map_size_);
+#endif
+	}
+}
+
+bool PieceArena::reserve(size_t reserve_bytes, size_t memory_limit, bool huge_pages) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	assert(!base_);
+
+	size_t chunk_size = kSlabDataSize;
+#ifndef _WIN32
+	if (huge_pages) {
+		chunk_size = kHugePageSize;
+	}
+#endif
+	size_t chunk_count = reserve_bytes / chunk_size;
+	if (chunk_count == 0) {
+		return false;
+	}
+	size_t size = chunk_count * chunk_size;
+
+#ifdef _WIN32
+	char* map_base = (char*)::VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+	if (!map_base) {
+		return false;
+	}
+	map_size_ = size;
+	map_base_ = map_base;
+	base_ = map_base;
+	huge_pages_ = false;
+#else
+	void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (huge_pages) {
+		// no MAP_NORESERVE here, an unbacked hugetlb page faults with SIGBUS
+		// instead of failing the reservation.
+		p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			map_base_ = (char*)p;
+			map_size_ = size;
+			base_ = map_base_;
+			huge_pages_ = true;
+		}
+	}
+#endif
+	if (p == MAP_FAILED) {
+		// over-reserve by one huge page so the base can be aligned for THP
+		size_t map_size = huge_pages ? size + kHugePageSize : size;
+		p = ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		map_base_ = (char*)p;
+		map_size_ = map_size;
+		base_ = map_base_;
+		if (huge_pages) {
+			base_ = (char*)(((uintptr_t)map_base_ + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+#ifdef MADV_HUGEPAGE
+			huge_pages_ = ::madvise(base_, size, MADV_HUGEPAGE) == 0;
+#endif
+		}
+	}
+#endif
+
+	chunk_size_ = chunk_size;
+	slabs_per_chunk_ = (uint32_t)(chunk_size / kSlabDataSize);
+	chunk_count_ = (uint32_t)chunk_count;
+	memory_limit_ = memory_limit;
+	chunk_used_.assign(chunk_count_, 0);
+	chunk_resident_.assign(chunk_count_, false);
+
+	uint32_t slot_count = chunk_count_ * slabs_per_chunk_;
+	free_slots_.reserve(slot_count);
+	for (uint32_t i = slot_count; i > 0; --i) {
+		free_slots_.push_back(i - 1);
+	}
+	return true;
+}
+
+char* PieceArena::allocSlabData() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (free_slots_.empty()) {
+		return nullptr;
+	}
+
+	uint32_t slot = free_slots_.back();
+	uint32_t chunk = slot / slabs_per_chunk_;
+	if (!chunk_resident_[chunk] && !commitChunk(chunk)) {
+		return nullptr;
+	}
+	free_slots_.pop_back();
+	chunk_used_[chunk]++;
+	used_bytes_ += kSlabDataSize;
+	return base_ + (size_t)slot * kSlabDataSize;
+}
+
+void PieceArena::freeSlabData(char* data) {
+	assert(contains(data));
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	uint32_t slot = (uint32_t)((data - base_) / kSlabDataSize);
+	uint32_t chunk = slot / slabs_per_chunk_;
+	assert(chunk_used_[chunk] > 0);
+	free_slots_.push_back(slot);
+	chunk_used_[chunk]--;
+	used_bytes_ -= kSlabDataSize;
+
+	if (chunk_used_[chunk] == 0 && resident_bytes_ > memory_limit_) {
+		releaseChunk(chunk);
+	}
+}
+
+size_t PieceArena::residentBytes() const {
+	std::unique_lock<std::mutex> lock(mutex_);
+	return resident_bytes_;
+}
+
+size_t PieceArena::idleBytes() const {
+	std::unique_lock<std::mutex> lock(mutex_);
+	return resident_bytes_ - used_bytes_;
+}
+
+bool PieceArena::commitChunk(uint32_t chunk) {
+#ifdef _WIN32
+	if (!::VirtualAlloc(base_ + (size_t)chunk * chunk_size_, chunk_size_, MEM_COMMIT, PAGE_READWRITE)) {
+		return false;
+	}
+#endif
+	chunk_resident_[chunk] = true;
+	resident_bytes_ += chunk_size_;
+	return true;
+}
+
+void PieceArena::releaseChunk(uint32_t chunk) {
+	char* addr = base_ + (size_t)chunk * chunk_size_;
+#ifdef _WIN32
+	if (!::VirtualFree(addr, chunk_size_, MEM_DECOMMIT)) {
+		return;
+	}
+#else
+	if (::madvise(addr, chunk_size_, MADV_DONTNEED) != 0) {
+		return;
+	}
+#endif
+	chunk_resident_[chunk] = false;
+	resident_bytes_ -= chunk_size_;
+}
+}
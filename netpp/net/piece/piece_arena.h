@@ -0,0 +1,51 @@
+#pragma once
+#include <netpp/net/piece/piece_allocator.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+namespace netpp {
+// Reserves one large address range up front and hands out slab payloads
+// from it. Memory is committed chunk by chunk, a chunk is one slab or one
+// huge page (2 MiB) when huge pages are in use. Fully idle chunks are
+// given back to the OS while the resident size is above memory_limit.
+class PieceArena
+{
+public:
+	PieceArena();
+	~PieceArena();
+
+	bool reserve(size_t reserve_bytes, size_t memory_limit, bool huge_pages);
+	bool isReserved() const { return base_ != nullptr; }
+	bool contains(const char* data) const {
+		return data >= base_ && data < base_ + (size_t)chunk_count_ * chunk_size_; }
+
+	// returns nullptr when the arena is exhausted
+	char* allocSlabData();
+	void freeSlabData(char* data);
+
+	size_t reservedBytes() const { return (size_t)chunk_count_ * chunk_size_; }
+	size_t residentBytes() const;
+	size_t idleBytes() const;
+	bool hugePages() const { return huge_pages_; }
+
+private:
+	bool commitChunk(uint32_t chunk);
+	void releaseChunk(uint32_t chunk);
+
+	mutable std::mutex mutex_;
+	char* map_base_;
+	size_t map_size_;
+	char* base_;
+	size_t chunk_size_;
+	uint32_t slabs_per_chunk_;
+	uint32_t chunk_count_;
+	bool huge_pages_;
+	size_t memory_limit_;
+	size_t resident_bytes_;
+	size_t used_bytes_;
+	std::vector<uint32_t> chunk_used_;
+	std::vector<bool> chunk_resident_;
+	std::vector<uint32_t> free_slots_;
+};
+}
@@ -0,0 +1,260 @@
+#include <netpp/net/piece/piece_search.h>
+#include <assert.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NETPP_SEARCH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NETPP_TARGET_AVX2
+#else
+#define NETPP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NETPP_SEARCH_SSE2 1
+#endif
+#endif
+
+namespace netpp {
+namespace {
+typedef const char* (*FindByteFn)(const char*, const char*, char);
+typedef const char* (*FindBytePairFn)(const char*, const char*, char, char);
+
+struct SearchKernels
+{
+	FindByteFn find_byte;
+	FindBytePairFn find_pair;
+	const char* name;
+};
+
+const char* findByteScalar(const char* begin, const char* end, char c) {
+	return (const char*)memchr(begin, c, end - begin);
+}
+
+const char* findBytePairScalar(const char* begin, const char* end, char c0, char c1) {
+	while (end - begin >= 2) {
+		const char* p = (const char*)memchr(begin, c0, end - begin - 1);
+		if (!p) {
+			break;
+		}
+		if (p[1] == c1) {
+			return p;
+		}
+		begin = p + 1;
+	}
+	return nullptr;
+}
+
+#ifdef NETPP_SEARCH_X86
+inline uint32_t lowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+bool cpuHasAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) 
+		&& (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return os_avx && (info[1] & (1 << 5));
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+NETPP_TARGET_AVX2
+const char* findByteAVX2(const char* begin, const char* end, char c) {
+	const __m256i needle = _mm256_set1_epi8(c);
+	const char* p = begin;
+	for (; end - p >= 64; p += 64) {
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), needle);
+		__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), needle);
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+			uint32_t mask = (uint32_t)_mm256_movemask_epi8(a);
+			if (mask) {
+				return p + lowestBit(mask);
+			}
+			return p + 32 + lowestBit((uint32_t)_mm256_movemask_epi8(b));
+		}
+	}
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+		if (mask) {
+			return p + lowestBit(mask);
+		}
+	}
+	return findByteScalar(p, end, c);
+}
+
+NETPP_TARGET_AVX2
+const char* findBytePairAVX2(const char* begin, const char* end, char c0, char c1) {
+	const __m256i first = _mm256_set1_epi8(c0);
+	const __m256i second = _mm256_set1_epi8(c1);
+	const char* p = begin;
+	for (; end - p >= 65; p += 64) {
+		__m256i a = _mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), first),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), second));
+		__m256i b = _mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), first),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 33)), second));
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+			uint32_t mask = (uint32_t)_mm256_movemask_epi8(a);
+			if (mask) {
+				return p + lowestBit(mask);
+			}
+			return p + 32 + lowestBit((uint32_t)_mm256_movemask_epi8(b));
+		}
+	}
+	for (; end - p >= 33; p += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)p);
+		__m256i b = _mm256_loadu_si256((const __m256i*)(p + 1));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, second)));
+		if (mask) {
+			return p + lowestBit(mask);
+		}
+	}
+	return findBytePairScalar(p, end, c0, c1);
+}
+#endif
+
+#ifdef NETPP_SEARCH_SSE2
+const char* findByteSSE2(const char* begin, const char* end, char c) {
+	const __m128i needle = _mm_set1_epi8(c);
+	const char* p = begin;
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+		if (mask) {
+			return p + lowestBit(mask);
+		}
+	}
+	return findByteScalar(p, end, c);
+}
+
+const char* findBytePairSSE2(const char* begin, const char* end, char c0, char c1) {
+	const __m128i first = _mm_set1_epi8(c0);
+	const __m128i second = _mm_set1_epi8(c1);
+	const char* p = begin;
+	for (; end - p >= 17; p += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)p);
+		__m128i b = _mm_loadu_si128((const __m128i*)(p + 1));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second)));
+		if (mask) {
+			return p + lowestBit(mask);
+		}
+	}
+	return findBytePairScalar(p, end, c0, c1);
+}
+#endif
+
+SearchKernels selectKernels() {
+	SearchKernels k = { findByteScalar, findBytePairScalar, "scalar" };
+#ifdef NETPP_SEARCH_SSE2
+	k.find_byte = findByteSSE2;
+	k.find_pair = findBytePairSSE2;
+	k.name = "sse2";
+#endif
+#ifdef NETPP_SEARCH_X86
+	if (cpuHasAVX2()) {
+		k.find_byte = findByteAVX2;
+		k.find_pair = findBytePairAVX2;
+		k.name = "avx2";
+	}
+#endif
+	return k;
+}
+
+const SearchKernels& kernels() {
+	static const SearchKernels k = selectKernels();
+	return k;
+}
+
+bool matchAt(const Piece* piece, size_t idx, const char* delim, size_t len) {
+	while (len > 0) {
+		if (!piece) {
+			return false;
+		}
+		size_t left = piece->off + piece->len - idx;
+		size_t n = len < left ? len : left;
+		if (memcmp(piece->data + idx, delim, n) != 0) {
+			return false;
+		}
+		delim += n;
+		len -= n;
+		piece = piece->next;
+		if (piece) {
+			idx = piece->off;
+		}
+	}
+	return true;
+}
+}
+
+const char* findByte(const char* begin, const char* end, char c) {
+	return kernels().find_byte(begin, end, c);
+}
+
+const char* findBytePair(const char* begin, const char* end, char c0, char c1) {
+	return kernels().find_pair(begin, end, c0, c1);
+}
+
+const char* searchKernelName() {
+	return kernels().name;
+}
+
+size_t searchPieces(const Piece* piece, size_t idx, const char* delim, size_t len) {
+	assert(len > 0);
+	const SearchKernels& k = kernels();
+	size_t offset = 0;
+	while (piece) {
+		const char* begin = piece->data + idx;
+		const char* end = piece->data + piece->off + piece->len;
+
+		if (len == 1) {
+			const char* p = k.find_byte(begin, end, delim[0]);
+			if (p) {
+				return offset + (p - begin);
+			}
+		}
+		else {
+			const char* from = begin;
+			const char* p;
+			while ((p = k.find_pair(from, end, delim[0], delim[1])) != nullptr) {
+				if (len == 2 || matchAt(piece, p - piece->data, delim, len)) {
+					return offset + (p - begin);
+				}
+				from = p + 1;
+			}
+			// a match starting on the last byte straddles into the next piece
+			if (end > begin && end[-1] == delim[0] 
+				&& matchAt(piece, end - 1 - piece->data, delim, len)) {
+				return offset + (end - 1 - begin);
+			}
+		}
+
+		offset += end - begin;
+		piece = piece->next;
+		if (piece) {
+			idx = piece->off;
+		}
+	}
+	return kSearchNotFound;
+}
+}
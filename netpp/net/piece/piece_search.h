@@ -0,0 +1,17 @@
+#pragma once
+#include <netpp/net/piece/piece_allocator.h>
+#include <stddef.h>
+
+namespace netpp {
+	const size_t kSearchNotFound = static_cast<size_t>(-1);
+
+	// Kernels are picked once at runtime: AVX2, SSE2, then scalar.
+	// findByte returns the first c in [begin, end), findBytePair the first p
+	// with p[0] == c0 && p[1] == c1 and p + 1 < end, nullptr when not found.
+	const char* findByte(const char* begin, const char* end, char c);
+	const char* findBytePair(const char* begin, const char* end, char c0, char c1);
+	const char* searchKernelName();
+
+	// Offset of delim from byte idx of piece, matches may straddle pieces.
+	size_t searchPieces(const Piece* piece, size_t idx, const char* delim, size_t len);
+}
@@ -49,7 +49,7 @@ public:
 
 	T* pop()
 	{
-		Piece* item = nullptr;
+		T* item = nullptr;
 		if (head_) {
 			item = head_;
 			head_ = head_->next;
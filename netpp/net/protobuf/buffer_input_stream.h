@@ -1,8 +1,10 @@
 #pragma once
 #include <netpp/net/buffer.h>
+#include <netpp/net/buffer_cursor.h>
 #include <netpp/net/piece/piece_allocator.h>
 #include <netpp/base/logging.h>
 #include <google/protobuf/io/zero_copy_stream.h>
+#include <algorithm>
 
 namespace netpp {
 class BufferInputStream : public google::protobuf::io::ZeroCopyInputStream
@@ -81,4 +83,59 @@ private:
 	Piece* drop_;
 	size_t originalSize_;
 };
+
+// Zero-copy view of limit bytes of a Buffer starting offset bytes in, e.g.
+// one frame out of several pipelined ones. Nothing is consumed, skip the
+// frame afterwards.
+class BoundedBufferInputStream : public google::protobuf::io::ZeroCopyInputStream
+{
+public:
+	BoundedBufferInputStream(Buffer* buf, size_t limit, size_t offset = 0)
+		: cursor_(buf)
+		, offset_(std::min(offset, buf->length()))
+		, limit_(offset_ + std::min(limit, buf->length() - offset_))
+		, pending_(0) {
+		cursor_.advance(offset_);
+	}
+
+	virtual bool Next(const void** data, int* size) {
+		cursor_.advance(pending_);
+		pending_ = 0;
+		size_t left = limit_ - cursor_.position();
+		if (left == 0) {
+			return false;
+		}
+		pending_ = std::min(left, cursor_.contiguousLength());
+		*data = cursor_.data();
+		*size = static_cast<int>(pending_);
+		return true;
+	}
+
+	virtual void BackUp(int count) {
+		assert(count >= 0 && (size_t)count <= pending_);
+		pending_ -= count;
+	}
+
+	virtual bool Skip(int count) {
+		cursor_.advance(pending_);
+		pending_ = 0;
+		size_t left = limit_ - cursor_.position();
+		if ((size_t)count > left) {
+			cursor_.advance(left);
+			return false;
+		}
+		cursor_.advance(count);
+		return true;
+	}
+
+	virtual google::protobuf::int64 ByteCount() const {
+		return cursor_.position() - offset_ + pending_;
+	}
+
+private:
+	BufferCursor cursor_;
+	size_t offset_;
+	size_t limit_;
+	size_t pending_;
+};
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <netpp/net/buffer.h>
+#include <netpp/net/piece/piece_allocator.h>
 #include <netpp/base/logging.h>
 #include <google/protobuf/io/zero_copy_stream.h>
 
@@ -24,22 +25,43 @@ class BufferOutputStream : public google::protobuf::io::ZeroCopyOutputStream
     return buffer_->length() - originalSize_;
   }
 
+  // Appends len bytes in a single piece and returns where to write them,
+  // nullptr when len does not fit one piece.
+  static char* appendContiguous(Buffer* buf, size_t len) {
+	  return static_cast<FlatOutputBuffer*>(buf)->flatAppend(len);
+  }
+
  private:
 	 class FlatOutputBuffer : public Buffer {
 	 public:
 		 bool flatNext(void** data, int* size) {
-			 Piece* last = back();
-			 if (!last || last->off + last->len == sizeof(last->data)) {
+			 Piece* last = writableBack();
+			 if (!last) {
 				 push(newPiece());
 				 last = back();
 			 }
 			 *data = last->data + last->off + last->len;
-			 *size = sizeof(last->data) - last->off - last->len;
-			 last->len = sizeof(last->data) - last->off;
+			 *size = kPieceCapacity - last->off - last->len;
+			 last->len = kPieceCapacity - last->off;
 			 length_ += *size;
 			 return true;
 		 }
 
+		 char* flatAppend(size_t len) {
+			 if (len > kPieceCapacity) {
+				 return nullptr;
+			 }
+			 Piece* last = writableBack();
+			 if (!last || (size_t)(kPieceCapacity - last->off - last->len) < len) {
+				 push(newPiece());
+				 last = back();
+			 }
+			 char* p = last->data + last->off + last->len;
+			 last->len += len;
+			 length_ += len;
+			 return p;
+		 }
+
 		 void flatBackUp(size_t len) {
 			 Piece* last = back();
 			 assert(last);
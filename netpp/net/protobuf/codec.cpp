@@ -2,6 +2,10 @@
 #include <netpp/base/logging.h>
 #include <netpp/net/protobuf/buffer_input_stream.h>
 #include <netpp/net/protobuf/buffer_output_stream.h>
+#include <netpp/net/crc32c.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <algorithm>
+#include <chrono>
 
 namespace netpp {
 const std::string kNoErrorStr = "NoError";
@@ -10,8 +14,45 @@ const std::string kCheckSumErrorStr = "CheckSumError";
 const std::string kInvalidNameLenStr = "InvalidNameLen";
 const std::string kUnknownMessageTypeStr = "UnknownMessageType";
 const std::string kParseErrorStr = "ParseError";
+const std::string kInvalidTypeIdStr = "InvalidTypeId";
+const std::string kCompressionErrorStr = "CompressionError";
 const std::string kUnknownErrorStr = "UnknownError";
 
+// CRC32C of the len bytes at the cursor, piece by piece, moves the cursor past them
+static uint32_t checksumOf(BufferCursor* cursor, size_t len) {
+	uint32_t crc = 0;
+	while (len > 0) {
+		size_t n = std::min(len, cursor->contiguousLength());
+		crc = crc32cExtend(crc, cursor->data(), n);
+		cursor->advance(n);
+		len -= n;
+	}
+	return crc;
+}
+
+// bytes of the name length and name, or of the varint type id, in front of
+// a message body of at most len bytes
+static size_t typeHeadLen(Buffer* buf, bool idMode, size_t len) {
+	BufferCursor cursor(buf);
+	if (idMode) {
+		size_t n = 0;
+		while (n < len && n < kMaxVarintLen) {
+			char b = cursor.current();
+			cursor.advance(1);
+			n++;
+			if (!(b & 0x80)) {
+				break;
+			}
+		}
+		return n;
+	}
+	if (len < sizeof(int32_t)) {
+		return len;
+	}
+	int32_t nameLen = internal::decodeValue<int32_t, kBigEndian>(cursor.peekContiguous(sizeof(int32_t)));
+	return std::min(len, sizeof(int32_t) + std::max(nameLen, 0));
+}
+
 int32_t asInt32(const char* buf)
 {
 	int32_t be32 = 0;
@@ -19,11 +60,253 @@ int32_t asInt32(const char* buf)
 	return htons(be32);
 }
 
+void ProtobufCodec::notePeerCompressor(const TCPConnPtr& conn, uint8_t id) {
+	std::lock_guard<std::mutex> lock(connMutex_);
+	if (!workerPool_) {
+		connStates_[conn.get()].peerCompressor = id;
+	}
+	else {
+		// on the pool the connection may be gone already, keep its state gone
+		auto it = connStates_.find(conn.get());
+		if (it != connStates_.end()) {
+			it->second.peerCompressor = id;
+		}
+	}
+}
+
+// Decodes the head of the frame at the front of buf with a cursor, then
+// moves the whole frame into a RawFrame. Unknown types are not an error.
+RawFramePtr ProtobufCodec::takeRawFrame(const TCPConnPtr& conn, Buffer* buf, int32_t len, ErrorCode* error, bool* peerKnown) {
+	RawFramePtr frame(new RawFrame(this));
+	const size_t frameEnd = kHeaderLen + len - (checksum_ ? kChecksumLen : 0);
+	BufferCursor cursor(buf);
+	cursor.advance(kHeaderLen);
+	if (compression_) {
+		frame->flags_ = static_cast<uint8_t>(cursor.current());
+		cursor.advance(kFlagsLen);
+		if (conn && !*peerKnown) {
+			notePeerCompressor(conn, frame->flags_ >> 4);
+			*peerKnown = true;
+		}
+		uint8_t used = frame->flags_ & kMaxCompressorId;
+		if (used) {
+			frame->compressor_ = compressors_[used].get();
+			if (!frame->compressor_) {
+				*error = kCompressionError;
+				return RawFramePtr();
+			}
+		}
+	}
+
+	if (typeTable_) {
+		uint64_t id = 0;
+		bool done = false;
+		for (int shift = 0; shift < 64 && cursor.position() < frameEnd; shift += 7) {
+			uint8_t b = static_cast<uint8_t>(cursor.current());
+			cursor.advance(1);
+			id |= (uint64_t)(b & 0x7f) << shift;
+			if (!(b & 0x80)) {
+				done = true;
+				break;
+			}
+		}
+		if (!done || id >= MessageTypeTable::kInvalidId) {
+			*error = kInvalidTypeId;
+			return RawFramePtr();
+		}
+		frame->typeId_ = static_cast<uint32_t>(id);
+	}
+	else {
+		if (cursor.position() + kHeaderLen > frameEnd) {
+			*error = kInvalidNameLen;
+			return RawFramePtr();
+		}
+		int32_t nameLen = internal::decodeValue<int32_t, kBigEndian>(cursor.peekContiguous(kHeaderLen));
+		cursor.advance(kHeaderLen);
+		if (nameLen <= 0) {
+			*error = kInvalidNameLen;
+			return RawFramePtr();
+		}
+		if ((size_t)nameLen > frameEnd - cursor.position()) {
+			*error = kParseError;
+			return RawFramePtr();
+		}
+		// drop the trailing NUL
+		const char* name = cursor.peekContiguous(nameLen);
+		frame->typeName_.assign(name, strnlen(name, nameLen));
+		cursor.advance(nameLen);
+	}
+
+	frame->payloadOffset_ = cursor.position();
+	frame->payloadLen_ = frameEnd - cursor.position();
+	// the cursor is done with, the pieces are shared rather than copied
+	buf->read(kHeaderLen + len, &frame->frame_);
+	return frame;
+}
+
+void ProtobufCodec::forward(const TCPConnPtr& conn, const RawFrame& frame) {
+	const ProtobufCodec* source = frame.codec_;
+	bool reencode = source != this && (source->typeTable_ != typeTable_
+		|| source->checksum_ != checksum_ || source->compression_ != compression_);
+	if (!reencode && frame.compressor_) {
+		uint8_t peer = 0;
+		{
+			std::lock_guard<std::mutex> lock(connMutex_);
+			auto it = connStates_.find(conn.get());
+			if (it != connStates_.end()) {
+				peer = it->second.peerCompressor;
+			}
+		}
+		reencode = peer != (frame.flags_ & kMaxCompressorId);
+	}
+	if (reencode) {
+		MessagePtr message = frame.parse();
+		if (message) {
+			send(conn, *message);
+		}
+		else {
+			LOG_ERROR << "ProtobufCodec::forward - cannot parse " << frame.typeName() << " to re-encode it";
+		}
+		return;
+	}
+
+	Buffer out;
+	if (!compression_ || (frame.flags_ >> 4) == acceptId_) {
+		frame.frame_.slice(0, frame.frame_.length(), &out);
+	}
+	else {
+		// advertise our own compressor, everything after the flags is shared
+		size_t trailerLen = checksum_ ? kChecksumLen : 0;
+		out.writeInt32(static_cast<int32_t>(frame.frame_.length() - kHeaderLen));
+		out.writeInt8(static_cast<int8_t>((acceptId_ << 4) | (frame.flags_ & kMaxCompressorId)));
+		frame.frame_.slice(kHeaderLen + kFlagsLen, frame.frame_.length() - kHeaderLen - kFlagsLen - trailerLen, &out);
+		if (checksum_) {
+			appendChecksum(&out, 0);
+		}
+	}
+	conn->send(&out);
+}
+
+const std::string& RawFrame::typeName() const {
+	if (typeId_ != MessageTypeTable::kInvalidId) {
+		const google::protobuf::Message* p = prototype();
+		return p ? p->GetDescriptor()->full_name() : typeName_;
+	}
+	return typeName_;
+}
+
+const google::protobuf::Message* RawFrame::prototype() const {
+	if (typeId_ != MessageTypeTable::kInvalidId) {
+		const MessageTypeTable* table = codec_->typeTable_;
+		return typeId_ < table->size() ? table->prototype(typeId_) : nullptr;
+	}
+	return ProtobufCodec::findPrototype(typeName_);
+}
+
+MessagePtr RawFrame::parse() const {
+	const google::protobuf::Message* p = prototype();
+	if (!p) {
+		return MessagePtr();
+	}
+	MessagePtr message(p->New());
+	if (!parseInto(message.get())) {
+		return MessagePtr();
+	}
+	return message;
+}
+
+int ProtobufCodec::minFrameLen() const {
+	return (typeTable_ ? kMinIdMessageLen : kMinMessageLen) + (checksum_ ? kChecksumLen : 0)
+		+ (compression_ ? kFlagsLen : 0);
+}
+
 void ProtobufCodec::onMessage(const TCPConnPtr& conn, Buffer* buf) {
-	while (buf->length() >= kMinMessageLen + kHeaderLen)
+	if (!workerPool_) {
+		processFrames(conn, buf);
+		return;
+	}
+
+	// find the complete frames, they leave the loop as one batch
+	const int minLen = minFrameLen();
+	size_t batchLen = 0;
+	bool invalid = false;
+	{
+		BufferCursor cursor(buf);
+		while (cursor.remaining() >= (size_t)(minLen + kHeaderLen)) {
+			const int32_t len = internal::decodeValue<int32_t, kBigEndian>(cursor.peekContiguous(kHeaderLen));
+			if (len > kMaxMessageLen || len < minLen) {
+				invalid = true;
+				break;
+			}
+			if (cursor.remaining() < (size_t)len + kHeaderLen) {
+				break;
+			}
+			cursor.advance(kHeaderLen + len);
+			batchLen += kHeaderLen + len;
+		}
+	}
+
+	if (batchLen > 0) {
+		// the pieces are shared rather than copied
+		std::shared_ptr<Buffer> batch = std::make_shared<Buffer>();
+		buf->read(batchLen, batch.get());
+		WorkerPool::StrandPtr strand;
+		bool pause = false;
+		{
+			std::lock_guard<std::mutex> lock(connMutex_);
+			ConnState& state = connStates_[conn.get()];
+			if (!state.strand) {
+				state.strand = workerPool_->newStrand();
+			}
+			strand = state.strand;
+			state.queuedBytes += batchLen;
+			if (state.queuedBytes > maxQueuedBytes_ && !state.readPaused) {
+				state.readPaused = pause = true;
+			}
+		}
+		// the frames left the input buffer, so the server's buffer budget no
+		// longer sees them; pause before the strand can resume
+		if (pause) {
+			conn->pauseRead();
+		}
+		strand->post([this, conn, batch, batchLen]() {
+			processFrames(conn, batch.get());
+			batchDone(conn, batchLen);
+		});
+	}
+	if (invalid) {
+		errorCallback_(conn, buf, kInvalidLength);
+	}
+}
+
+void ProtobufCodec::batchDone(const TCPConnPtr& conn, size_t batchLen) {
+	bool resume = false;
+	{
+		std::lock_guard<std::mutex> lock(connMutex_);
+		auto it = connStates_.find(conn.get());
+		if (it == connStates_.end()) {
+			return;
+		}
+		ConnState& state = it->second;
+		state.queuedBytes -= batchLen;
+		if (state.readPaused && state.queuedBytes <= maxQueuedBytes_ / 2) {
+			state.readPaused = false;
+			resume = true;
+		}
+	}
+	if (resume) {
+		conn->resumeRead();
+	}
+}
+
+void ProtobufCodec::processFrames(const TCPConnPtr& conn, Buffer* buf) {
+	const int minLen = minFrameLen();
+	ArenaPtr arena;
+	bool peerKnown = false;
+	while (buf->length() >= (size_t)(minLen + kHeaderLen))
 	{
 		const int32_t len = buf->peekInt32();
-		if (len > kMaxMessageLen || len < kMinMessageLen)
+		if (len > kMaxMessageLen || len < minLen)
 		{
 			errorCallback_(conn, buf, kInvalidLength);
 			break;
@@ -31,11 +314,76 @@ void ProtobufCodec::onMessage(const TCPConnPtr& conn, Buffer* buf) {
 		else if (buf->length() >= len + kHeaderLen)
 		{
 			ErrorCode errorCode = kNoError;
+			int32_t bodyLen = len;
+			if (checksum_) {
+				bodyLen -= kChecksumLen;
+				BufferCursor cursor(buf);
+				cursor.advance(kHeaderLen);
+				uint32_t crc = checksumOf(&cursor, bodyLen);
+				if (crc != internal::decodeValue<uint32_t, kBigEndian>(cursor.peekContiguous(kChecksumLen))) {
+					errorCallback_(conn, buf, kCheckSumError);
+					break;
+				}
+			}
+			if (rawFrameCallback_) {
+				RawFramePtr frame = takeRawFrame(conn, buf, len, &errorCode, &peerKnown);
+				if (!frame) {
+					errorCallback_(conn, buf, errorCode);
+					break;
+				}
+				rawFrameCallback_(conn, frame);
+				continue;
+			}
 			buf->skip(kHeaderLen);
-			MessagePtr message = parse(buf, len, &errorCode);
+			FrameCompressor* compressor = nullptr;
+			if (compression_) {
+				uint8_t flags = static_cast<uint8_t>(buf->readInt8());
+				bodyLen -= kFlagsLen;
+				if (conn && !peerKnown) {
+					notePeerCompressor(conn, flags >> 4);
+					peerKnown = true;
+				}
+				uint8_t used = flags & kMaxCompressorId;
+				if (used) {
+					compressor = compressors_[used].get();
+					if (!compressor) {
+						errorCallback_(conn, buf, kCompressionError);
+						break;
+					}
+				}
+			}
+			uint32_t typeId = MessageTypeTable::kInvalidId;
+			if (arenaBlockSize_ > 0 && !arena) {
+				google::protobuf::ArenaOptions options;
+				options.start_block_size = arenaBlockSize_;
+				arena = std::make_shared<google::protobuf::Arena>(options);
+			}
+			std::chrono::steady_clock::time_point start;
+			size_t compressedLen = 0;
+			if (compressor) {
+				compressedLen = bodyLen - typeHeadLen(buf, typeTable_ != nullptr, bodyLen);
+				start = std::chrono::steady_clock::now();
+			}
+			MessagePtr message = typeTable_ ? parse(buf, bodyLen, *typeTable_, &errorCode, &typeId, arena, compressor)
+				: parse(buf, bodyLen, &errorCode, arena, compressor);
 			if (errorCode == kNoError && message)
 			{
-				messageCallback_(conn, message);
+				if (compressor) {
+					uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+					counters_.frames_decompressed.fetch_add(1, std::memory_order_relaxed);
+					counters_.decompress_in.fetch_add(compressedLen, std::memory_order_relaxed);
+					counters_.decompress_out.fetch_add(message->ByteSizeLong(), std::memory_order_relaxed);
+					counters_.decompress_wall_ns.fetch_add(ns, std::memory_order_relaxed);
+				}
+				if (checksum_) {
+					buf->skip(kChecksumLen);
+				}
+				if (typeTable_ && idMessageCallback_) {
+					idMessageCallback_(conn, message, typeId);
+				}
+				else {
+					messageCallback_(conn, message);
+				}
 			}
 			else
 			{
@@ -52,10 +400,114 @@ void ProtobufCodec::onMessage(const TCPConnPtr& conn, Buffer* buf) {
 
 void ProtobufCodec::send(const TCPConnPtr& conn, const google::protobuf::Message& message) {
 	Buffer buf;
-	fillEmptyBuffer(&buf, message);
+	if (!appendFrame(&buf, message, frameEncoding(conn))) {
+		LOG_ERROR << "ProtobufCodec::send - cannot encode message type " << message.GetTypeName();
+		return;
+	}
 	conn->send(&buf);
 }
 
+void ProtobufCodec::sendBatch(const TCPConnPtr& conn, const std::vector<MessagePtr>& messages) {
+	MessageBatch batch(this, conn);
+	for (const MessagePtr& message : messages) {
+		if (!batch.add(*message)) {
+			LOG_ERROR << "ProtobufCodec::sendBatch - cannot encode message type " << message->GetTypeName();
+		}
+	}
+	batch.send(conn);
+}
+
+bool MessageBatch::add(const google::protobuf::Message& message) {
+	if (!ProtobufCodec::appendFrame(&buf_, message, encoding_)) {
+		return false;
+	}
+	++count_;
+	return true;
+}
+
+void MessageBatch::send(const TCPConnPtr& conn, TCPConn::Priority priority) {
+	if (count_ > 0) {
+		conn->send(&buf_, priority);
+	}
+	clear();
+}
+
+void ProtobufCodec::addCompressor(uint8_t id, const FrameCompressorPtr& compressor) {
+	assert(id > 0 && id <= kMaxCompressorId);
+	compressors_[id] = compressor;
+}
+
+void ProtobufCodec::setCompression(uint8_t acceptId, size_t threshold) {
+	assert(acceptId <= kMaxCompressorId && (acceptId == 0 || compressors_[acceptId]));
+	compression_ = true;
+	acceptId_ = acceptId;
+	compressThreshold_ = threshold;
+}
+
+void ProtobufCodec::onConnection(const TCPConnPtr& conn) {
+	if (conn->isConnected()) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(connMutex_);
+	auto it = connStates_.find(conn.get());
+	if (it == connStates_.end()) {
+		return;
+	}
+	if (!it->second.strand) {
+		connStates_.erase(it);
+		return;
+	}
+	// Drop the state behind the batches still queued, so they and any late
+	// one keep running on this strand rather than on a new one next to it.
+	// Holding conn keeps its address from being reused meanwhile.
+	WorkerPool::StrandPtr strand = it->second.strand;
+	strand->post([this, conn, strand]() {
+		std::lock_guard<std::mutex> lock(connMutex_);
+		auto it = connStates_.find(conn.get());
+		if (it != connStates_.end() && it->second.strand == strand) {
+			connStates_.erase(it);
+		}
+	});
+}
+
+ProtobufCodec::CompressionStats ProtobufCodec::compressionStats() const {
+	CompressionStats stats;
+	stats.frames_compressed = counters_.frames_compressed.load(std::memory_order_relaxed);
+	stats.compress_in = counters_.compress_in.load(std::memory_order_relaxed);
+	stats.compress_out = counters_.compress_out.load(std::memory_order_relaxed);
+	stats.compress_wall_ns = counters_.compress_wall_ns.load(std::memory_order_relaxed);
+	stats.frames_decompressed = counters_.frames_decompressed.load(std::memory_order_relaxed);
+	stats.decompress_in = counters_.decompress_in.load(std::memory_order_relaxed);
+	stats.decompress_out = counters_.decompress_out.load(std::memory_order_relaxed);
+	stats.decompress_wall_ns = counters_.decompress_wall_ns.load(std::memory_order_relaxed);
+	return stats;
+}
+
+ProtobufCodec::FrameEncoding ProtobufCodec::frameEncoding(const TCPConnPtr& conn) {
+	FrameEncoding encoding;
+	encoding.table = typeTable_;
+	encoding.checksum = checksum_;
+	encoding.flags = compression_;
+	if (compression_) {
+		encoding.acceptId = acceptId_;
+		encoding.threshold = compressThreshold_;
+		encoding.counters = &counters_;
+		uint8_t peer = 0;
+		if (conn) {
+			std::lock_guard<std::mutex> lock(connMutex_);
+			auto it = connStates_.find(conn.get());
+			if (it != connStates_.end()) {
+				peer = it->second.peerCompressor;
+			}
+		}
+		if (peer && compressors_[peer]) {
+			encoding.compressorId = peer;
+			encoding.compressor = compressors_[peer].get();
+		}
+	}
+	return encoding;
+}
+
 const std::string& ProtobufCodec::errorCodeToString(ErrorCode errorCode){
 	switch (errorCode)
 	{
@@ -69,52 +521,182 @@ const std::string& ProtobufCodec::errorCodeToString(ErrorCode errorCode){
 		return kUnknownMessageTypeStr;
 	case kParseError:
 		return kParseErrorStr;
+	case kInvalidTypeId:
+		return kInvalidTypeIdStr;
+	case kCheckSumError:
+		return kCheckSumErrorStr;
+	case kCompressionError:
+		return kCompressionErrorStr;
 	default:
 		return kUnknownErrorStr;
 	}
 }
 
-void ProtobufCodec::fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message) {
-	const std::string& typeName = message.GetTypeName();
-	int32_t nameLen = static_cast<int32_t>(typeName.size() + 1);
+void ProtobufCodec::fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message, bool checksum) {
+	FrameEncoding encoding;
+	encoding.checksum = checksum;
+	appendFrame(buf, message, encoding);
+}
+
+bool ProtobufCodec::fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message, const MessageTypeTable& table
+	, bool checksum) {
+	FrameEncoding encoding;
+	encoding.table = &table;
+	encoding.checksum = checksum;
+	return appendFrame(buf, message, encoding);
+}
+
+// [len][flags][nameLen][name][body][checksum] or [len][flags][id][body][checksum],
+// flags and checksum only when the encoding has them
+bool ProtobufCodec::appendFrame(Buffer* buf, const google::protobuf::Message& message, const FrameEncoding& encoding) {
+	// flags byte plus the varint id or the name length
+	char head[kFlagsLen + kMaxVarintLen];
+	size_t headLen = encoding.flags ? kFlagsLen : 0;
+	std::string typeName;
+	size_t nameLen = 0;
+	if (encoding.table) {
+		uint32_t id = encoding.table->idOf(message.GetDescriptor());
+		if (id == MessageTypeTable::kInvalidId) {
+			return false;
+		}
+		headLen += internal::encodeVarint(id, head + headLen);
+	}
+	else {
+		typeName = message.GetTypeName();
+		nameLen = typeName.size() + 1;
+		internal::encodeValue<int32_t, kBigEndian>(static_cast<int32_t>(nameLen), head + headLen);
+		headLen += kHeaderLen;
+	}
+
+	// sizes are computed once here and cached for the serializer
+	size_t bodyLen = message.ByteSizeLong();
+	size_t trailerLen = encoding.checksum ? kChecksumLen : 0;
+	FrameCompressor* compressor = bodyLen >= encoding.threshold ? encoding.compressor : nullptr;
+	if (encoding.flags) {
+		head[0] = static_cast<char>((encoding.acceptId << 4) | (compressor ? encoding.compressorId : 0));
+	}
+
+	if (!compressor) {
+		int32_t len = static_cast<int32_t>(headLen + nameLen + bodyLen + trailerLen);
+		char* p = BufferOutputStream::appendContiguous(buf, kHeaderLen + len);
+		if (p) {
+			internal::encodeValue<int32_t, kBigEndian>(len, p);
+			memcpy(p + kHeaderLen, head, headLen);
+			memcpy(p + kHeaderLen + headLen, typeName.c_str(), nameLen);
+			char* end = reinterpret_cast<char*>(message.SerializeWithCachedSizesToArray(
+				reinterpret_cast<uint8_t*>(p + kHeaderLen + headLen + nameLen)));
+			if (encoding.checksum) {
+				internal::encodeValue<uint32_t, kBigEndian>(crc32c(p + kHeaderLen, end - p - kHeaderLen), end);
+			}
+			return true;
+		}
+	}
+
+	appendStreamedFrame(buf, message, encoding, compressor, head, headLen, typeName, bodyLen);
+	return true;
+}
+
+// Frames that do not fit the tail piece and compressed ones. The length is
+// filled in last, since a compressed body's size is only known once it is
+// written; pieces never move, so the pointer stays valid.
+void ProtobufCodec::appendStreamedFrame(Buffer* buf, const google::protobuf::Message& message, const FrameEncoding& encoding
+	, FrameCompressor* compressor, const char* head, size_t headLen, const std::string& typeName, size_t bodyLen) {
+	size_t nameLen = typeName.empty() ? 0 : typeName.size() + 1;
+	size_t frameStart = buf->length();
+	char* lenField = BufferOutputStream::appendContiguous(buf, kHeaderLen);
+	buf->write(headLen, head);
+	if (nameLen > 0) {
+		buf->write(nameLen, typeName.c_str());
+	}
+	if (compressor) {
+		size_t before = buf->length();
+		auto start = std::chrono::steady_clock::now();
+		bool ok;
+		{
+			BufferOutputStream output(buf);
+			ok = compressor->compress(message, &output);
+		}
+		if (!ok) {
+			LOG_ERROR << "ProtobufCodec::appendStreamedFrame - " << compressor->name() << " failed on "
+				<< message.GetTypeName() << ", sending it uncompressed";
+			buf->truncate(frameStart);
+			char plain[kFlagsLen + kMaxVarintLen];
+			memcpy(plain, head, headLen);
+			// a compressor is only used with the flags byte in front
+			plain[0] = static_cast<char>(plain[0] & ~kMaxCompressorId);
+			appendStreamedFrame(buf, message, encoding, nullptr, plain, headLen, typeName, bodyLen);
+			return;
+		}
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (encoding.counters) {
+			encoding.counters->frames_compressed.fetch_add(1, std::memory_order_relaxed);
+			encoding.counters->compress_in.fetch_add(bodyLen, std::memory_order_relaxed);
+			encoding.counters->compress_out.fetch_add(buf->length() - before, std::memory_order_relaxed);
+			encoding.counters->compress_wall_ns.fetch_add(ns, std::memory_order_relaxed);
+		}
+	}
+	else {
+		serializeBody(buf, message);
+	}
+	if (encoding.checksum) {
+		appendChecksum(buf, frameStart);
+	}
+	internal::encodeValue<int32_t, kBigEndian>(static_cast<int32_t>(buf->length() - frameStart - kHeaderLen), lenField);
+}
 
-	buf->reservedPrepend(sizeof(kHeaderLen));
-	buf->writeInt32(nameLen);
-	buf->write(nameLen, typeName.c_str());
+void ProtobufCodec::serializeBody(Buffer* buf, const google::protobuf::Message& message) {
 	BufferOutputStream output(buf);
-	message.SerializeToZeroCopyStream(&output);
-	buf->prependInt32(buf->length());
+	google::protobuf::io::CodedOutputStream coded(&output);
+	message.SerializeWithCachedSizes(&coded);
 }
 
-google::protobuf::Message* ProtobufCodec::createMessage(const std::string& type_name) {
-	google::protobuf::Message* message = NULL;
+void ProtobufCodec::appendChecksum(Buffer* buf, size_t frameStart) {
+	BufferCursor cursor(buf);
+	cursor.advance(frameStart + kHeaderLen);
+	buf->write<uint32_t>(checksumOf(&cursor, cursor.remaining()));
+}
+
+const google::protobuf::Message* ProtobufCodec::findPrototype(const std::string& type_name) {
 	const google::protobuf::Descriptor* descriptor =
 		google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
 	if (descriptor)
 	{
-		const google::protobuf::Message* prototype =
-			google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
-		if (prototype)
-		{
-			message = prototype->New();
-		}
+		return google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
 	}
-	return message;
+	return NULL;
+}
+
+google::protobuf::Message* ProtobufCodec::createMessage(const std::string& type_name) {
+	const google::protobuf::Message* prototype = findPrototype(type_name);
+	return prototype ? prototype->New() : NULL;
+}
+
+MessagePtr ProtobufCodec::newMessage(const google::protobuf::Message* prototype, const ArenaPtr& arena) {
+	if (arena) {
+		// aliasing constructor: the message shares the arena's control block,
+		// no allocation of its own and nothing to delete
+		return MessagePtr(arena, prototype->New(arena.get()));
+	}
+	return MessagePtr(prototype->New());
 }
 
-MessagePtr ProtobufCodec::parse(Buffer* buf, int len, ErrorCode* error) {
+MessagePtr ProtobufCodec::parse(Buffer* buf, int len, ErrorCode* error, const ArenaPtr& arena
+	, FrameCompressor* compressor) {
 	MessagePtr message;
 
 	int32_t nameLen = buf->readInt32();
 	if (nameLen > 0)
 	{
-		if (buf->length() >= nameLen){
+		if (nameLen <= len - kHeaderLen){
 			std::string typeName;
 			buf->read(nameLen, typeName);
-			message.reset(createMessage(typeName));
-			if (message) {
-				BufferInputStream input(buf);
-				message->ParseFromZeroCopyStream(&input);
+			const google::protobuf::Message* prototype = findPrototype(typeName.c_str());
+			if (prototype) {
+				message = newMessage(prototype, arena);
+				if (!parseBody(message.get(), buf, len - kHeaderLen - nameLen, compressor)) {
+					*error = compressor ? kCompressionError : kParseError;
+					message.reset();
+				}
 			}
 			else {
 				*error = kUnknownMessageType;
@@ -132,6 +714,64 @@ MessagePtr ProtobufCodec::parse(Buffer* buf, int len, ErrorCode* error) {
 	return message;
 }
 
+MessagePtr ProtobufCodec::parse(Buffer* buf, int len, const MessageTypeTable& table, ErrorCode* error
+	, uint32_t* typeId, const ArenaPtr& arena, FrameCompressor* compressor) {
+	MessagePtr message;
+
+	size_t before = buf->length();
+	uint64_t id = 0;
+	if (buf->readVarint(&id) != Buffer::kVarintOk || before - buf->length() > (size_t)len) {
+		*error = kInvalidTypeId;
+		return message;
+	}
+
+	const google::protobuf::Message* prototype = id < table.size() ? table.prototype((uint32_t)id) : nullptr;
+	if (!prototype) {
+		*error = kUnknownMessageType;
+		return message;
+	}
+
+	if (typeId) {
+		*typeId = (uint32_t)id;
+	}
+
+	message = newMessage(prototype, arena);
+	if (!parseBody(message.get(), buf, len - (before - buf->length()), compressor)) {
+		*error = compressor ? kCompressionError : kParseError;
+		message.reset();
+	}
+	return message;
+}
+
+bool ProtobufCodec::parseBody(google::protobuf::Message* message, Buffer* buf, size_t len, FrameCompressor* compressor) {
+	bool ok = parseView(message, buf, 0, len, compressor);
+	if (len > 0) {
+		buf->skip(len);
+	}
+	return ok;
+}
+
+// parse only [offset, offset + len) of buf in place: straight from the piece
+// when it is contiguous, otherwise through a stream bounded to it
+bool ProtobufCodec::parseView(google::protobuf::Message* message, Buffer* buf, size_t offset, size_t len
+	, FrameCompressor* compressor) {
+	if (compressor) {
+		// decompressed bodies get the same cap as frames
+		BoundedBufferInputStream input(buf, len, offset);
+		return compressor->decompress(&input, message, kMaxMessageLen);
+	}
+	if (len == 0) {
+		return true;
+	}
+	BufferCursor cursor(buf);
+	cursor.advance(offset);
+	if (cursor.contiguousLength() >= len) {
+		return message->ParseFromArray(cursor.data(), static_cast<int>(len));
+	}
+	BoundedBufferInputStream input(buf, len, offset);
+	return message->ParseFromZeroCopyStream(&input);
+}
+
 void ProtobufCodec::defaultErrorCallback(const TCPConnPtr& conn, Buffer* buf, ErrorCode errorCode) {
 	LOG_ERROR << "ProtobufCodec::defaultErrorCallback - " << errorCodeToString(errorCode);
 	if (conn && conn->isConnected())
@@ -2,13 +2,23 @@
 
 #include <netpp/net/buffer.h>
 #include <netpp/net/tcp_conn.h>
+#include <netpp/net/protobuf/message_type_table.h>
+#include <netpp/net/protobuf/frame_compressor.h>
+#include <netpp/net/worker_pool.h>
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <google/protobuf/message.h>
+#include <google/protobuf/arena.h>
 
 namespace netpp {
 
 typedef std::shared_ptr<google::protobuf::Message> MessagePtr;
+class RawFrame;
+typedef std::shared_ptr<RawFrame> RawFramePtr;
 
 class ProtobufCodec : boost::noncopyable
 {
@@ -20,38 +30,325 @@ public:
 		kInvalidNameLen,
 		kUnknownMessageType,
 		kParseError,
+		kInvalidTypeId,
+		kCheckSumError,
+		// unknown compressor id, or a body that does not decompress within kMaxMessageLen
+		kCompressionError,
+	};
+
+	struct CompressionStats
+	{
+		uint64_t frames_compressed = 0;
+		uint64_t compress_in = 0;     // serialized bytes
+		uint64_t compress_out = 0;    // compressed body bytes
+		// Wall time in the compressor, preemption included. Thread CPU clocks
+		// tick too coarsely on Windows to time single frames.
+		uint64_t compress_wall_ns = 0;
+		uint64_t frames_decompressed = 0;
+		uint64_t decompress_in = 0;   // compressed body bytes
+		uint64_t decompress_out = 0;  // serialized bytes
+		uint64_t decompress_wall_ns = 0;
+
+		double sendRatio() const { return compress_out ? (double)compress_in / compress_out : 0; }
+		double receiveRatio() const { return decompress_in ? (double)decompress_out / decompress_in : 0; }
 	};
 
 	typedef std::function<void(const TCPConnPtr&, const MessagePtr&)> ProtobufMessageCallback;
 	typedef std::function<void(const TCPConnPtr&, Buffer*, ErrorCode)> ErrorCallback;
+	typedef std::function<void(const TCPConnPtr&, const MessagePtr&, uint32_t type_id)> ProtobufIdMessageCallback;
+	typedef std::function<void(const TCPConnPtr&, const RawFramePtr&)> RawFrameCallback;
 
 	explicit ProtobufCodec(const ProtobufMessageCallback& messageCb)
-		: messageCallback_(messageCb)
+		: typeTable_(nullptr)
+		, messageCallback_(messageCb)
 		, errorCallback_(defaultErrorCallback) {
 	}
 
 	ProtobufCodec(const ProtobufMessageCallback& messageCb, const ErrorCallback& errorCb)
-		: messageCallback_(messageCb)
+		: typeTable_(nullptr)
+		, messageCallback_(messageCb)
 		, errorCallback_(errorCb) {
 	}
 
+	// Numeric id mode: frames carry a varint type id from table instead of the
+	// type name. Both peers must register the same ids, table must outlive
+	// the codec.
+	ProtobufCodec(const MessageTypeTable* table, const ProtobufMessageCallback& messageCb)
+		: typeTable_(table)
+		, messageCallback_(messageCb)
+		, errorCallback_(defaultErrorCallback) {
+	}
+
+	ProtobufCodec(const MessageTypeTable* table, const ProtobufMessageCallback& messageCb, const ErrorCallback& errorCb)
+		: typeTable_(table)
+		, messageCallback_(messageCb)
+		, errorCallback_(errorCb) {
+	}
+
+	// Id mode only, replaces the message callback and also passes the decoded
+	// type id, e.g. to FlatProtobufDispatcher.
+	void setIdMessageCallback(const ProtobufIdMessageCallback& cb) { idMessageCallback_ = cb; }
+
+	// Deliver every frame unparsed instead, e.g. for a gateway that routes on
+	// the type and forwards most payloads. Frames of unknown types are
+	// delivered too. The codec must outlive the frames.
+	void setRawFrameCallback(const RawFrameCallback& cb) { rawFrameCallback_ = cb; }
+
+	// Allocate the messages decoded by one onMessage call from a shared
+	// protobuf Arena instead of the heap, 0 turns it off. A message kept past
+	// its callback keeps the whole batch's arena alive.
+	void setArenaBlockSize(size_t startBlockSize) { arenaBlockSize_ = startBlockSize; }
+
+	// Append a CRC32C of everything after the length field as a 4 byte
+	// trailer, and verify it before parsing. Both peers must agree.
+	void setChecksum(bool on) { checksum_ = on; }
+	bool checksum() const { return checksum_; }
+
+	// Per-frame compression. Registers compressors under wire ids 1-15, which
+	// must mean the same on both peers.
+	void addCompressor(uint8_t id, const FrameCompressorPtr& compressor);
+	// Adds a flags byte after the length field of every frame, both peers
+	// must turn it on. Each frame advertises acceptId, a registered compressor
+	// this side decodes. Frames to a connection are compressed only once its
+	// peer advertised a compressor we have, and only bodies of at least
+	// threshold bytes. Call onConnection from the connection callback so the
+	// per-connection state is dropped on disconnect.
+	void setCompression(uint8_t acceptId, size_t threshold);
+	CompressionStats compressionStats() const;
+
+	// Parse and handle frames on pool instead of the I/O loop. onMessage then
+	// only slices complete frames off the input buffer; each connection's
+	// frames are handled in order, one batch at a time, on a strand of pool.
+	// Callbacks run on pool threads and may reply with send() as usual. Call
+	// onConnection from the connection callback, stop pool before the codec
+	// is destroyed.
+	void setWorkerPool(WorkerPool* pool) { workerPool_ = pool; }
+	// Reads of a connection pause while more than maxBytes of its frames
+	// wait on the pool, and resume once the backlog drops to half of it.
+	void setMaxQueuedBytes(size_t maxBytes) { maxQueuedBytes_ = maxBytes; }
+
+	void onConnection(const TCPConnPtr& conn);
+
 	void onMessage(const TCPConnPtr& conn, Buffer* buf);
 	void send(const TCPConnPtr& conn, const google::protobuf::Message& message);
+	// Encodes all messages into one buffer and sends it with a single
+	// TCPConn::send. Unregistered types are logged and skipped in id mode.
+	void sendBatch(const TCPConnPtr& conn, const std::vector<MessagePtr>& messages);
+	// Sends a raw frame, possibly received by another codec, to one of this
+	// codec's connections without re-encoding it. Falls back to parse and
+	// send() when the framings differ or conn's peer cannot decode the
+	// frame's compression.
+	void forward(const TCPConnPtr& conn, const RawFrame& frame);
+	const MessageTypeTable* typeTable() const { return typeTable_; }
 
 
 	static const std::string& errorCodeToString(ErrorCode errorCode);
-	static void fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message);
+	// Appends one frame, buf does not need to be empty.
+	static void fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message, bool checksum = false);
+	typedef std::shared_ptr<google::protobuf::Arena> ArenaPtr;
 	static google::protobuf::Message* createMessage(const std::string& type_name);
-	static MessagePtr parse(Buffer* buf, int len, ErrorCode* errorCode);
+	static MessagePtr parse(Buffer* buf, int len, ErrorCode* errorCode, const ArenaPtr& arena = ArenaPtr()
+		, FrameCompressor* compressor = nullptr);
+	// id mode, fillEmptyBuffer fails if the message type is not registered
+	static bool fillEmptyBuffer(Buffer* buf, const google::protobuf::Message& message, const MessageTypeTable& table
+		, bool checksum = false);
+	static MessagePtr parse(Buffer* buf, int len, const MessageTypeTable& table, ErrorCode* errorCode
+		, uint32_t* typeId = nullptr, const ArenaPtr& arena = ArenaPtr(), FrameCompressor* compressor = nullptr);
 
 private:
+	friend class MessageBatch;
+	friend class RawFrame;
+
+	struct CompressionCounters
+	{
+		std::atomic<uint64_t> frames_compressed = { 0 };
+		std::atomic<uint64_t> compress_in = { 0 };
+		std::atomic<uint64_t> compress_out = { 0 };
+		std::atomic<uint64_t> compress_wall_ns = { 0 };
+		std::atomic<uint64_t> frames_decompressed = { 0 };
+		std::atomic<uint64_t> decompress_in = { 0 };
+		std::atomic<uint64_t> decompress_out = { 0 };
+		std::atomic<uint64_t> decompress_wall_ns = { 0 };
+	};
+
+	// wire layout of a frame apart from the message itself
+	struct FrameEncoding
+	{
+		const MessageTypeTable* table = nullptr;
+		bool checksum = false;
+		bool flags = false;
+		uint8_t acceptId = 0;
+		// bodies of at least threshold bytes are compressed with compressor
+		uint8_t compressorId = 0;
+		FrameCompressor* compressor = nullptr;
+		size_t threshold = 0;
+		CompressionCounters* counters = nullptr;
+	};
+
+	struct ConnState
+	{
+		uint8_t peerCompressor = 0;
+		WorkerPool::StrandPtr strand;
+		// frame bytes posted to strand and not handled yet
+		size_t queuedBytes = 0;
+		bool readPaused = false;
+	};
+
+	void processFrames(const TCPConnPtr& conn, Buffer* buf);
+	void batchDone(const TCPConnPtr& conn, size_t batchLen);
+	RawFramePtr takeRawFrame(const TCPConnPtr& conn, Buffer* buf, int32_t len, ErrorCode* error, bool* peerKnown);
+	void notePeerCompressor(const TCPConnPtr& conn, uint8_t id);
+	int minFrameLen() const;
+	FrameEncoding frameEncoding(const TCPConnPtr& conn);
+	static bool appendFrame(Buffer* buf, const google::protobuf::Message& message, const FrameEncoding& encoding);
+	static void appendStreamedFrame(Buffer* buf, const google::protobuf::Message& message, const FrameEncoding& encoding
+		, FrameCompressor* compressor, const char* head, size_t headLen, const std::string& typeName, size_t bodyLen);
 	static void defaultErrorCallback(const TCPConnPtr&, Buffer*, ErrorCode);
+	static const google::protobuf::Message* findPrototype(const std::string& type_name);
+	static MessagePtr newMessage(const google::protobuf::Message* prototype, const ArenaPtr& arena);
+	static bool parseBody(google::protobuf::Message* message, Buffer* buf, size_t len, FrameCompressor* compressor);
+	static bool parseView(google::protobuf::Message* message, Buffer* buf, size_t offset, size_t len
+		, FrameCompressor* compressor);
+	static void serializeBody(Buffer* buf, const google::protobuf::Message& message);
+	static void appendChecksum(Buffer* buf, size_t frameStart);
 
+	const MessageTypeTable* typeTable_;
 	ProtobufMessageCallback messageCallback_;
+	ProtobufIdMessageCallback idMessageCallback_;
+	RawFrameCallback rawFrameCallback_;
 	ErrorCallback errorCallback_;
+	size_t arenaBlockSize_ = 0;
+	bool checksum_ = false;
+
+	static const uint8_t kMaxCompressorId = 15;
+	FrameCompressorPtr compressors_[kMaxCompressorId + 1];
+	bool compression_ = false;
+	uint8_t acceptId_ = 0;
+	size_t compressThreshold_ = 0;
+	CompressionCounters counters_;
+	WorkerPool* workerPool_ = nullptr;
+	size_t maxQueuedBytes_ = kDefaultMaxQueuedBytes;
+	// by connection object, ids are only unique per server or client
+	std::mutex connMutex_;
+	std::unordered_map<const TCPConn*, ConnState> connStates_;
 
 	const static int kHeaderLen = sizeof(int32_t);
+	const static int kChecksumLen = sizeof(uint32_t);
 	const static int kMinMessageLen = 2 * kHeaderLen + 2;
+	const static int kMinIdMessageLen = 1;
+	const static int kFlagsLen = 1;
 	const static int kMaxMessageLen = 64 * 1024 * 1024;
+	const static size_t kDefaultMaxQueuedBytes = 4 * 1024 * 1024;
+};
+
+// Frames many messages back to back into one piece chain so they go out
+// with a single TCPConn::send (one loop post from other threads). The batch
+// is empty again after send() and can be reused.
+class MessageBatch : boost::noncopyable
+{
+public:
+	// Type-id frames when table is set, type-name frames otherwise, with a
+	// checksum trailer when asked to. Must match the receiving codec.
+	explicit MessageBatch(const MessageTypeTable* table = nullptr, bool checksum = false)
+		: count_(0) {
+		encoding_.table = table;
+		encoding_.checksum = checksum;
+	}
+
+	// Frames as codec would send them to conn, compression included. The
+	// codec must outlive the batch.
+	MessageBatch(ProtobufCodec* codec, const TCPConnPtr& conn)
+		: encoding_(codec->frameEncoding(conn))
+		, count_(0) {
+	}
+
+	// false if the message type is not registered in id mode
+	bool add(const google::protobuf::Message& message);
+	void send(const TCPConnPtr& conn, TCPConn::Priority priority = TCPConn::kPriorityNormal);
+	void clear() { buf_.clear(); count_ = 0; }
+
+	size_t count() const { return count_; }
+	size_t length() const { return buf_.length(); }
+	bool empty() const { return count_ == 0; }
+	Buffer* buffer() { return &buf_; }
+
+private:
+	ProtobufCodec::FrameEncoding encoding_;
+	Buffer buf_;
+	size_t count_;
 };
+
+// One received frame, not parsed. It holds views of the input pieces, the
+// payload is never copied. Parsing happens only when asked for.
+class RawFrame : boost::noncopyable
+{
+public:
+	// id mode, MessageTypeTable::kInvalidId otherwise
+	uint32_t typeId() const { return typeId_; }
+	// empty for an unknown id
+	const std::string& typeName() const;
+	// nullptr for an unknown type
+	const google::protobuf::Message* prototype() const;
+
+	bool compressed() const { return compressor_ != nullptr; }
+	// serialized payload, as it came over the wire when compressed()
+	size_t payloadLength() const { return payloadLen_; }
+	void payload(Buffer* buf) const { frame_.slice(payloadOffset_, payloadLen_, buf); }
+
+	MessagePtr parse() const;
+	// nullptr when the frame holds another type or does not parse
+	template<typename T>
+	std::shared_ptr<T> parseAs() const;
+
+	// ProtobufCodec::forward through the codec that received the frame, use
+	// the target connection's codec if that is another one.
+	void forward(const TCPConnPtr& conn) const { codec_->forward(conn, *this); }
+
+private:
+	friend class ProtobufCodec;
+
+	explicit RawFrame(ProtobufCodec* codec)
+		: codec_(codec)
+		, payloadOffset_(0)
+		, payloadLen_(0)
+		, flags_(0)
+		, typeId_(MessageTypeTable::kInvalidId)
+		, compressor_(nullptr) {
+	}
+
+	bool parseInto(google::protobuf::Message* message) const {
+		return ProtobufCodec::parseView(message, &frame_, payloadOffset_, payloadLen_, compressor_);
+	}
+
+	ProtobufCodec* codec_;
+	// the whole frame, length field and checksum included; cursors need a
+	// non-const Buffer but only read it
+	mutable Buffer frame_;
+	size_t payloadOffset_;
+	size_t payloadLen_;
+	uint8_t flags_;
+	uint32_t typeId_;
+	std::string typeName_;
+	FrameCompressor* compressor_;
+};
+
+template<typename T>
+std::shared_ptr<T> RawFrame::parseAs() const {
+	const google::protobuf::Descriptor* descriptor = T::descriptor();
+	if (typeId_ != MessageTypeTable::kInvalidId) {
+		const google::protobuf::Message* p = prototype();
+		if (p == nullptr || p->GetDescriptor() != descriptor) {
+			return std::shared_ptr<T>();
+		}
+	}
+	// by name, no DescriptorPool lookup on the routing path
+	else if (typeName_ != descriptor->full_name()) {
+		return std::shared_ptr<T>();
+	}
+	std::shared_ptr<T> message = std::make_shared<T>();
+	if (!parseInto(message.get())) {
+		return std::shared_ptr<T>();
+	}
+	return message;
+}
 }
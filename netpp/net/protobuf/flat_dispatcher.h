@@ -0,0 +1,117 @@
+#pragma once
+#include <netpp/net/protobuf/dispatcher.h>
+#include <netpp/net/protobuf/message_type_table.h>
+#include <memory>
+#include <vector>
+
+namespace netpp {
+// Dispatcher keyed by the dense ids of a MessageTypeTable: a lookup is one
+// array load and the handler call. Without a table the dispatcher assigns
+// ids itself in registration order, hand table() to the codec and register
+// in the same order on both peers.
+class FlatProtobufDispatcher : boost::noncopyable
+{
+public:
+	typedef std::function<void(const TCPConnPtr&, const MessagePtr& message)> ProtobufMessageCallback;
+
+	FlatProtobufDispatcher(const MessageTypeTable* table, const ProtobufMessageCallback& defaultCb)
+		: table_(table)
+		, defaultCallback_(defaultCb) {
+		defaultHandler_.thunk = &callDefault;
+		defaultHandler_.target = &defaultCallback_;
+		if (!table_) {
+			ownedTable_.reset(new MessageTypeTable);
+			table_ = ownedTable_.get();
+		}
+	}
+
+	const MessageTypeTable& table() const { return *table_; }
+
+	// For a codec in id mode, type_id is the id it decoded.
+	void onProtobufMessage(const TCPConnPtr& conn, const MessagePtr& message, uint32_t type_id) const {
+		const Handler& h = type_id < handlers_.size() ? handlers_[type_id] : defaultHandler_;
+		h.thunk(h.target, conn, message);
+	}
+
+	void onProtobufMessage(const TCPConnPtr& conn, const MessagePtr& message) const {
+		onProtobufMessage(conn, message, table_->idOf(message->GetDescriptor()));
+	}
+
+	template<typename T>
+	bool registerMessageCallback(const typename CallbackT<T>::ProtobufMessageTCallback& callback) {
+		typedef typename CallbackT<T>::ProtobufMessageTCallback Function;
+		std::shared_ptr<Function> target(new Function(callback));
+		if (!setHandler<T>(&callFunction<T>, target.get())) {
+			return false;
+		}
+		functions_.push_back(target);
+		return true;
+	}
+
+	// Handler fixed at compile time, dispatch calls it without going through
+	// a std::function.
+	template<typename T, void (*Fn)(const TCPConnPtr&, const std::shared_ptr<T>&)>
+	bool bindMessageHandler() {
+		return setHandler<T>(&callStatic<T, Fn>, nullptr);
+	}
+
+	template<typename T, typename C, void (C::*Method)(const TCPConnPtr&, const std::shared_ptr<T>&)>
+	bool bindMessageHandler(C* object) {
+		return setHandler<T>(&callMethod<T, C, Method>, object);
+	}
+
+private:
+	typedef void (*Thunk)(void* target, const TCPConnPtr& conn, const MessagePtr& message);
+	struct Handler {
+		Thunk thunk;
+		void* target;
+	};
+
+	template<typename T>
+	bool setHandler(Thunk thunk, void* target) {
+		BOOST_STATIC_ASSERT((boost::is_base_of<google::protobuf::Message, T>::value));
+		uint32_t id = table_->idOf(T::descriptor());
+		if (id == MessageTypeTable::kInvalidId && ownedTable_) {
+			id = (uint32_t)ownedTable_->size();
+			if (!ownedTable_->registerType<T>(id)) {
+				return false;
+			}
+		}
+		if (id == MessageTypeTable::kInvalidId) {
+			return false;
+		}
+		if (id >= handlers_.size()) {
+			handlers_.resize(id + 1, defaultHandler_);
+		}
+		handlers_[id].thunk = thunk;
+		handlers_[id].target = target;
+		return true;
+	}
+
+	static void callDefault(void* target, const TCPConnPtr& conn, const MessagePtr& message) {
+		(*static_cast<ProtobufMessageCallback*>(target))(conn, message);
+	}
+
+	template<typename T>
+	static void callFunction(void* target, const TCPConnPtr& conn, const MessagePtr& message) {
+		(*static_cast<typename CallbackT<T>::ProtobufMessageTCallback*>(target))(conn, std::static_pointer_cast<T>(message));
+	}
+
+	template<typename T, void (*Fn)(const TCPConnPtr&, const std::shared_ptr<T>&)>
+	static void callStatic(void*, const TCPConnPtr& conn, const MessagePtr& message) {
+		Fn(conn, std::static_pointer_cast<T>(message));
+	}
+
+	template<typename T, typename C, void (C::*Method)(const TCPConnPtr&, const std::shared_ptr<T>&)>
+	static void callMethod(void* target, const TCPConnPtr& conn, const MessagePtr& message) {
+		(static_cast<C*>(target)->*Method)(conn, std::static_pointer_cast<T>(message));
+	}
+
+	const MessageTypeTable* table_;
+	std::unique_ptr<MessageTypeTable> ownedTable_;
+	std::vector<Handler> handlers_;
+	Handler defaultHandler_;
+	std::vector<std::shared_ptr<void> > functions_;
+	ProtobufMessageCallback defaultCallback_;
+};
+}
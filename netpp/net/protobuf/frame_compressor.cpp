@@ -0,0 +1,34 @@
+#include <netpp/net/protobuf/frame_compressor.h>
+#ifdef NETPP_WITH_ZLIB
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/gzip_stream.h>
+#include <zlib.h>
+
+namespace netpp {
+bool ZlibFrameCompressor::compress(const google::protobuf::Message& message, google::protobuf::io::ZeroCopyOutputStream* out) {
+	google::protobuf::io::GzipOutputStream::Options options;
+	options.format = google::protobuf::io::GzipOutputStream::ZLIB;
+	options.compression_level = level_;
+	google::protobuf::io::GzipOutputStream gzip(out, options);
+	bool ok = message.SerializeToZeroCopyStream(&gzip);
+	// Close() flushes the deflate tail into out
+	return gzip.Close() && ok;
+}
+
+bool ZlibFrameCompressor::decompress(google::protobuf::io::ZeroCopyInputStream* in, google::protobuf::Message* message
+	, size_t maxLen) {
+	google::protobuf::io::GzipInputStream gzip(in, google::protobuf::io::GzipInputStream::ZLIB);
+	bool ok;
+	{
+		// inflates one output buffer at a time and stops at maxLen, a small
+		// frame must not expand into gigabytes
+		google::protobuf::io::CodedInputStream coded(&gzip);
+		coded.SetTotalBytesLimit(static_cast<int>(maxLen), -1);
+		ok = message->ParseFromCodedStream(&coded) && coded.ConsumedEntireMessage();
+	}
+	// a broken deflate stream ends the input early, which the parser takes
+	// for EOF and may accept as a truncated message
+	return ok && gzip.ZlibErrorCode() == Z_STREAM_END;
+}
+}
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include <memory>
+#include <google/protobuf/message.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+
+namespace netpp {
+// Per-frame body compression for ProtobufCodec. Both calls work on the
+// frame's zero-copy streams, so bytes go straight from and into the piece
+// chain. One instance is shared by all connections of a codec, possibly on
+// several loops at once, so implementations must keep no per-call state.
+class FrameCompressor
+{
+public:
+	virtual ~FrameCompressor() {}
+
+	virtual const char* name() const = 0;
+	// Serializes message into out, compressed.
+	virtual bool compress(const google::protobuf::Message& message, google::protobuf::io::ZeroCopyOutputStream* out) = 0;
+	// Parses message from in, which ends with the compressed body. Fails
+	// once the decompressed body grows past maxLen bytes.
+	virtual bool decompress(google::protobuf::io::ZeroCopyInputStream* in, google::protobuf::Message* message
+		, size_t maxLen) = 0;
+};
+
+typedef std::shared_ptr<FrameCompressor> FrameCompressorPtr;
+
+#ifdef NETPP_WITH_ZLIB
+// zlib deflate through protobuf's gzip streams, level as for zlib (-1 is its default).
+// Needs zlib and a protobuf built with it (-Dprotobuf_WITH_ZLIB=ON), so it
+// is only compiled when NETPP_WITH_ZLIB is defined.
+class ZlibFrameCompressor : public FrameCompressor
+{
+public:
+	explicit ZlibFrameCompressor(int level = -1)
+		: level_(level) {
+	}
+
+	virtual const char* name() const { return "zlib"; }
+	virtual bool compress(const google::protobuf::Message& message, google::protobuf::io::ZeroCopyOutputStream* out);
+	virtual bool decompress(google::protobuf::io::ZeroCopyInputStream* in, google::protobuf::Message* message
+		, size_t maxLen);
+
+private:
+	int level_;
+};
+#endif
+}
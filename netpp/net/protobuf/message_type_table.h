@@ -0,0 +1,52 @@
+#pragma once
+#include <google/protobuf/message.h>
+#include <boost/noncopyable.hpp>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace netpp {
+// Up-front mapping between message types and compact numeric wire ids. Ids
+// index a vector, so keep them small and dense. Register everything before
+// the table is handed to a codec, lookups are not synchronized.
+class MessageTypeTable : boost::noncopyable
+{
+public:
+	static const uint32_t kInvalidId = static_cast<uint32_t>(-1);
+	static const uint32_t kMaxId = 64 * 1024;
+
+	template<typename T>
+	bool registerType(uint32_t id) {
+		return registerType(id, &T::default_instance());
+	}
+
+	bool registerType(uint32_t id, const google::protobuf::Message* prototype) {
+		const google::protobuf::Descriptor* descriptor = prototype->GetDescriptor();
+		if (id >= kMaxId || ids_.count(descriptor) || (id < prototypes_.size() && prototypes_[id])) {
+			return false;
+		}
+		if (id >= prototypes_.size()) {
+			prototypes_.resize(id + 1, nullptr);
+		}
+		prototypes_[id] = prototype;
+		ids_[descriptor] = id;
+		return true;
+	}
+
+	const google::protobuf::Message* prototype(uint32_t id) const {
+		return id < prototypes_.size() ? prototypes_[id] : nullptr;
+	}
+
+	uint32_t idOf(const google::protobuf::Descriptor* descriptor) const {
+		auto it = ids_.find(descriptor);
+		return it != ids_.end() ? it->second : kInvalidId;
+	}
+
+	// One past the largest registered id.
+	size_t size() const { return prototypes_.size(); }
+
+private:
+	std::vector<const google::protobuf::Message*> prototypes_;
+	std::unordered_map<const google::protobuf::Descriptor*, uint32_t> ids_;
+};
+}
@@ -0,0 +1,185 @@
+#include <netpp/net/ring_input_buffer.h>
+#include <netpp/net/piece/piece_search.h>
+#include <netpp/base/logging.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace netpp {
+namespace {
+size_t mapGranularity() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return (size_t)::sysconf(_SC_PAGESIZE);
+#endif
+}
+
+char* mapMirror(size_t size) {
+#ifdef _WIN32
+	HANDLE mapping = ::CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE
+		, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+	if (!mapping) {
+		return nullptr;
+	}
+
+	// reserve 2 * size to find a free range, release it and map both views
+	// there, another thread may take the range in between so retry a few times.
+	char* base = nullptr;
+	for (int retry = 0; retry < 8 && !base; ++retry) {
+		char* addr = (char*)::VirtualAlloc(nullptr, size * 2, MEM_RESERVE, PAGE_NOACCESS);
+		if (!addr) {
+			break;
+		}
+		::VirtualFree(addr, 0, MEM_RELEASE);
+
+		void* first = ::MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, addr);
+		void* second = ::MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, addr + size);
+		if (first == addr && second == addr + size) {
+			base = addr;
+		}
+		else {
+			if (first) {
+				::UnmapViewOfFile(first);
+			}
+			if (second) {
+				::UnmapViewOfFile(second);
+			}
+		}
+	}
+	::CloseHandle(mapping);
+	return base;
+#else
+	int fd = -1;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	fd = ::memfd_create("netpp-ring", MFD_CLOEXEC);
+#else
+	char name[64];
+	snprintf(name, sizeof(name), "/netpp-ring-%d-%p", (int)::getpid(), (void*)&name);
+	fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		::shm_unlink(name);
+	}
+#endif
+	if (fd < 0) {
+		return nullptr;
+	}
+	if (::ftruncate(fd, (off_t)size) != 0) {
+		::close(fd);
+		return nullptr;
+	}
+
+	char* base = nullptr;
+	void* addr = ::mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr != MAP_FAILED) {
+		void* first = ::mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+		void* second = ::mmap((char*)addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+		if (first == addr && second == (char*)addr + size) {
+			base = (char*)addr;
+		}
+		else {
+			::munmap(addr, size * 2);
+		}
+	}
+	::close(fd);
+	return base;
+#endif
+}
+
+void unmapMirror(char* base, size_t size) {
+#ifdef _WIN32
+	::UnmapViewOfFile(base);
+	::UnmapViewOfFile(base + size);
+#else
+	::munmap(base, size * 2);
+#endif
+}
+}
+
+RingInputBuffer::RingInputBuffer()
+	: base_(nullptr)
+	, capacity_(0)
+	, read_off_(0)
+	, write_off_(0)
+	, length_(0) {
+}
+
+RingInputBuffer::~RingInputBuffer() {
+	if (base_) {
+		unmapMirror(base_, capacity_);
+	}
+}
+
+bool RingInputBuffer::init(size_t capacity) {
+	assert(!base_);
+	size_t granularity = mapGranularity();
+	capacity = (capacity + granularity - 1) / granularity * granularity;
+	base_ = mapMirror(capacity);
+	if (!base_) {
+		LOG_ERROR << "RingInputBuffer::init - mirror mapping of " << capacity << " bytes failed";
+		return false;
+	}
+	capacity_ = capacity;
+	return true;
+}
+
+void RingInputBuffer::hasWritten(size_t len) {
+	assert(len <= writable());
+	write_off_ += len;
+	if (write_off_ >= capacity_) {
+		write_off_ -= capacity_;
+	}
+	length_ += len;
+}
+
+void RingInputBuffer::read(size_t len, char* d) {
+	assert(len <= length_);
+	memcpy(d, peek(), len);
+	skip(len);
+}
+
+void RingInputBuffer::read(size_t len, std::string& d) {
+	d.assign(peek(), len);
+	skip(len);
+}
+
+void RingInputBuffer::skip(size_t len) {
+	assert(len <= length_);
+	read_off_ += len;
+	if (read_off_ >= capacity_) {
+		read_off_ -= capacity_;
+	}
+	length_ -= len;
+	if (length_ == 0) {
+		read_off_ = 0;
+		write_off_ = 0;
+	}
+}
+
+size_t RingInputBuffer::findDelimiter(const char* delim, size_t len) const {
+	assert(len > 0);
+	if (len > length_) {
+		return npos;
+	}
+	const char* begin = peek();
+	const char* end = begin + length_;
+	const char* p;
+	if (len == 1) {
+		p = findByte(begin, end, delim[0]);
+		return p ? p - begin : npos;
+	}
+	while ((p = findBytePair(begin, end, delim[0], delim[1])) != nullptr) {
+		if ((size_t)(end - p) >= len && memcmp(p, delim, len) == 0) {
+			return p - peek();
+		}
+		begin = p + 1;
+	}
+	return npos;
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <netpp/net/byte_order.h>
+#include <boost/noncopyable.hpp>
+#include <assert.h>
+#include <string>
+
+namespace netpp {
+// Input buffer backed by a virtual-memory "magic ring": the same physical
+// pages are mapped twice back to back, so the readable bytes and the free
+// space are always contiguous in memory and never need linearizing.
+class RingInputBuffer : public boost::noncopyable
+{
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+
+	RingInputBuffer();
+	~RingInputBuffer();
+
+	// capacity is rounded up to the page (allocation) granularity
+	bool init(size_t capacity);
+
+	size_t capacity() const { return capacity_; }
+	size_t length() const { return length_; }
+	size_t writable() const { return capacity_ - length_; }
+
+	const char* peek() const { return base_ + read_off_; }
+	char* beginWrite() { return base_ + write_off_; }
+	void hasWritten(size_t len);
+
+	template<typename T, Endian E = kBigEndian>
+	T peek() const {
+		assert(length_ >= sizeof(T));
+		return internal::decodeValue<T, E>(peek());
+	}
+	template<typename T, Endian E = kBigEndian>
+	T read() {
+		T x = peek<T, E>();
+		skip(sizeof(T));
+		return x;
+	}
+
+	void read(size_t len, char* d);
+	void read(size_t len, std::string& d);
+	void skip(size_t len);
+
+	// offset of delim from peek(), npos when not found
+	size_t findDelimiter(const char* delim, size_t len) const;
+
+private:
+	char* base_;
+	size_t capacity_;
+	size_t read_off_;
+	size_t write_off_;
+	size_t length_;
+};
+}
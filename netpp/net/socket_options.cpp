@@ -0,0 +1,122 @@
+#include <netpp/net/socket_options.h>
+#include <netpp/base/logging.h>
+#ifdef _WIN32
+#include <mstcpip.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+namespace netpp {
+namespace {
+bool setRawOption(ip::tcp::socket& sock, int level, int name, int value, const char* what) {
+#ifdef _WIN32
+	int ret = ::setsockopt(sock.native_handle(), level, name, (const char*)&value, sizeof(value));
+#else
+	int ret = ::setsockopt(sock.native_handle(), level, name, &value, sizeof(value));
+#endif
+	if (ret != 0) {
+		LOG_WARN << "applySocketOptions - set " << what << " failed";
+		return false;
+	}
+	return true;
+}
+
+template<typename Option>
+bool setAsioOption(ip::tcp::socket& sock, const Option& option, const char* what) {
+	boost::system::error_code ec;
+	sock.set_option(option, ec);
+	if (ec) {
+		LOG_WARN << "applySocketOptions - set " << what << " failed: " << ec.message();
+		return false;
+	}
+	return true;
+}
+
+bool setKeepAliveTimers(ip::tcp::socket& sock, const SocketOptions& opts) {
+	bool ok = true;
+#ifdef _WIN32
+	// Windows takes idle time and interval together, in milliseconds; the
+	// probe count is fixed by the system.
+	tcp_keepalive vals;
+	vals.onoff = 1;
+	vals.keepalivetime = (opts.keepalive_idle > 0 ? opts.keepalive_idle : 7200) * 1000;
+	vals.keepaliveinterval = (opts.keepalive_interval > 0 ? opts.keepalive_interval : 1) * 1000;
+	DWORD bytes = 0;
+	if (WSAIoctl(sock.native_handle(), SIO_KEEPALIVE_VALS, &vals, sizeof(vals), NULL, 0, &bytes, NULL, NULL) != 0) {
+		LOG_WARN << "applySocketOptions - set keepalive timers failed";
+		ok = false;
+	}
+#else
+#if defined(TCP_KEEPIDLE)
+	if (opts.keepalive_idle > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_KEEPIDLE, opts.keepalive_idle, "TCP_KEEPIDLE");
+	}
+#elif defined(TCP_KEEPALIVE)
+	if (opts.keepalive_idle > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_KEEPALIVE, opts.keepalive_idle, "TCP_KEEPALIVE");
+	}
+#endif
+#ifdef TCP_KEEPINTVL
+	if (opts.keepalive_interval > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_KEEPINTVL, opts.keepalive_interval, "TCP_KEEPINTVL");
+	}
+#endif
+#ifdef TCP_KEEPCNT
+	if (opts.keepalive_count > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_KEEPCNT, opts.keepalive_count, "TCP_KEEPCNT");
+	}
+#endif
+#endif
+	return ok;
+}
+}
+
+bool applySocketOptions(ip::tcp::socket& sock, const SocketOptions& opts) {
+	bool ok = true;
+	if (opts.recv_buffer > 0) {
+		ok &= setAsioOption(sock, socket_base::receive_buffer_size(opts.recv_buffer), "SO_RCVBUF");
+	}
+	if (opts.send_buffer > 0) {
+		ok &= setAsioOption(sock, socket_base::send_buffer_size(opts.send_buffer), "SO_SNDBUF");
+	}
+	if (opts.no_delay) {
+		ok &= setAsioOption(sock, ip::tcp::no_delay(true), "TCP_NODELAY");
+	}
+	if (opts.keepalive) {
+		ok &= setAsioOption(sock, socket_base::keep_alive(true), "SO_KEEPALIVE");
+		if (opts.keepalive_idle > 0 || opts.keepalive_interval > 0 || opts.keepalive_count > 0) {
+			ok &= setKeepAliveTimers(sock, opts);
+		}
+	}
+	if (opts.linger >= 0) {
+		ok &= setAsioOption(sock, socket_base::linger(true, opts.linger), "SO_LINGER");
+	}
+#ifdef TCP_QUICKACK
+	if (opts.quickack) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+	}
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+	if (opts.notsent_lowat > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts.notsent_lowat, "TCP_NOTSENT_LOWAT");
+	}
+#endif
+#ifdef SO_BUSY_POLL
+	if (opts.busy_poll > 0) {
+		ok &= setRawOption(sock, SOL_SOCKET, SO_BUSY_POLL, opts.busy_poll, "SO_BUSY_POLL");
+	}
+#endif
+#if defined(TCP_USER_TIMEOUT)
+	if (opts.user_timeout > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, opts.user_timeout, "TCP_USER_TIMEOUT");
+	}
+#elif defined(TCP_MAXRT)
+	if (opts.user_timeout > 0) {
+		ok &= setRawOption(sock, IPPROTO_TCP, TCP_MAXRT, (opts.user_timeout + 999) / 1000, "TCP_MAXRT");
+	}
+#endif
+	return ok;
+}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <boost/asio.hpp>
+
+namespace netpp {
+using namespace boost::asio;
+
+// Socket knobs applied once when a connection is accepted or before it
+// connects, never on the read/write path. Zero (or -1 for linger) keeps the
+// system default and costs no syscall. Options the platform lacks are skipped.
+struct SocketOptions {
+	int recv_buffer = 0;		// SO_RCVBUF, bytes
+	int send_buffer = 0;		// SO_SNDBUF, bytes
+	bool no_delay = false;		// TCP_NODELAY
+	bool keepalive = false;		// SO_KEEPALIVE
+	int keepalive_idle = 0;		// seconds idle before the first probe
+	int keepalive_interval = 0;	// seconds between probes
+	int keepalive_count = 0;	// unanswered probes before the peer is dropped
+	bool quickack = false;		// TCP_QUICKACK, the kernel may fall back to delayed acks later
+	int notsent_lowat = 0;		// TCP_NOTSENT_LOWAT, bytes
+	int busy_poll = 0;			// SO_BUSY_POLL, microseconds
+	int user_timeout = 0;		// TCP_USER_TIMEOUT, milliseconds
+	int linger = -1;			// SO_LINGER, seconds, -1 leaves linger off
+};
+
+// Returns false if any requested option could not be set, the rest are
+// still applied.
+bool applySocketOptions(ip::tcp::socket& sock, const SocketOptions& opts);
+}
@@ -7,6 +7,7 @@ namespace netpp {
 using namespace boost::asio;
 
 class Buffer;
+class RingInputBuffer;
 class TCPConn;
 typedef boost::shared_ptr<ip::tcp::socket> SocketPtr;
 typedef std::shared_ptr<TCPConn> TCPConnPtr;
@@ -16,8 +17,10 @@ typedef std::shared_ptr<TCPConn> TCPConnPtr;
 typedef std::function<void(const TCPConnPtr& conn)> ConnectionCallback;
 typedef std::function<void(const TCPConnPtr& conn)> CloseCallback;
 typedef std::function<void(const TCPConnPtr& conn)> WriteCompleteCallback;
+typedef std::function<void(const TCPConnPtr& conn, size_t output_length)> HighWaterMarkCallback;
 
 typedef std::function<void(const TCPConnPtr& conn, Buffer* buffer)> MessageCallback;
+typedef std::function<void(const TCPConnPtr& conn, RingInputBuffer* buffer)> RingMessageCallback;
 typedef std::function<bool(const ip::tcp::endpoint& remote_addr)> VerifyAddressCallback;
 
 namespace internal {
@@ -11,6 +11,7 @@ TCPClient::TCPClient(EventLoop* loop
 	, name_(name)
 	, auto_reconnect_(true)
 	, reconnect_interval_seconds_(3)
+	, has_socket_options_(false)
 	, is_connecting_(false) {
 }
 
@@ -28,8 +29,13 @@ void TCPClient::connect() {
 		}
 		is_connecting_ = true;
 		SocketPtr sock(new ip::tcp::socket(loop_->getIoService()));		
-		if (local_addr_.port() != 0) {
+		if (local_addr_.port() != 0 || has_socket_options_) {
 			sock->open(remote_addr_.protocol());
+		}
+		if (has_socket_options_) {
+			applySocketOptions(*sock, socket_options_);
+		}
+		if (local_addr_.port() != 0) {
 			sock->bind(local_addr_);
 		}
 		sock->async_connect(remote_addr_
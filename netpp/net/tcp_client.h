@@ -1,6 +1,7 @@
 #pragma once
 #include <netpp/net/tcp_conn.h>
 #include <netpp/net/event_loop.h>
+#include <netpp/net/socket_options.h>
 #include <string>
 #include <mutex>
 
@@ -24,6 +25,10 @@ public:
 	void setAutoReconnect(bool v) {	auto_reconnect_ = v; }
 	long getReconnectInterval() const { return reconnect_interval_seconds_; }
 	void setReconnectInterval(long seconds) { reconnect_interval_seconds_ = seconds; }
+	// Applied before each connect attempt, not thread safe.
+	void setSocketOptions(const SocketOptions& opts) {
+		socket_options_ = opts;
+		has_socket_options_ = true; }
 	void setContext(const boost::any& context) { context_ = context; }
 	const boost::any& getContext() const { return context_; }
 
@@ -47,6 +52,8 @@ private:
 	const std::string name_;
 	std::atomic<bool> auto_reconnect_;
 	long reconnect_interval_seconds_;
+	SocketOptions socket_options_;
+	bool has_socket_options_;
 	boost::any context_;
 
 	mutable std::mutex mutex_; // this guard of connection_
@@ -1,11 +1,14 @@
 #include <netpp/net/tcp_conn.h>
+#include <netpp/net/socket_options.h>
 #include <netpp/net/piece/piece_allocator.h>
+#include <netpp/base/logging.h>
 
 namespace netpp {
 void TCPConn::InputBuffer::writePiece(Piece* item) {
 	assert(item->len > 0);
+	size_t len = item->len;
 	Piece* last = back();
-	if (last && last->len + item->len <= sizeof(last->data)) {
+	if (last && last->len + item->len <= kPieceCapacity && !isPieceShared(last)) {
 		if (last->off > 0) {
 			memmove(last->data, last->data + last->off, last->len);
 			last->off = 0;
@@ -17,16 +20,16 @@ void TCPConn::InputBuffer::writePiece(Piece* item) {
 	else {
 		push(item);
 	}
-	length_ += item->len;
+	length_ += len;
 }
 
 Piece* TCPConn::OutputBuffer::readPiece() {
 	assert(length() > 0);
 	Piece* first = pop();
 	if (first) {
-		uint16_t capacity = sizeof(first->data);
+		uint16_t capacity = kPieceCapacity;
 
-		while (first->len < capacity) {
+		while (first->len < capacity && !isPieceShared(first)) {
 			Piece* next = front();
 			if (next && first->len + next->len <= capacity) {
 				if (first->off > 0) {
@@ -36,12 +39,35 @@ Piece* TCPConn::OutputBuffer::readPiece() {
 				pop();
 				memcpy(first->data + first->len, next->data + next->off, next->len);
 				first->len += next->len;
+				deletePiece(next);
 			}
 			else {
 				break;
 			}
 		}
 		length_ -= first->len;
+
+		size_t n = first->len;
+		if (partial_ >= n) {
+			partial_ -= n;
+			n = 0;
+		}
+		else {
+			n -= partial_;
+			partial_ = 0;
+		}
+		while (n > 0) {
+			assert(!messages_.empty());
+			size_t m = messages_.front();
+			messages_.pop_front();
+			if (m <= n) {
+				n -= m;
+			}
+			else {
+				partial_ = m - n;
+				n = 0;
+			}
+		}
 	}
 	return first;
 }
@@ -49,12 +75,16 @@ Piece* TCPConn::OutputBuffer::readPiece() {
 void TCPConn::OutputBuffer::writePieceQueue(Piece* queue_head){
 	assert(queue_head);
 	Piece* item = queue_head;
+	size_t len = 0;
 	while (item) {
 		assert(item->len > 0);
+		Piece* next = item->next;
+		len += item->len;
 		push(item);
-		length_ += item->len;
-		item = item->next;
+		item = next;
 	}
+	length_ += len;
+	messages_.push_back(len);
 }
 
 TCPConn::TCPConn(EventLoop* loop
@@ -64,7 +94,18 @@ TCPConn::TCPConn(EventLoop* loop
 	, id_(id)
 	, socket_(sock)
 	, status_(kDisconnected)
-	, is_sending_(false) {
+	, is_sending_(false)
+	, is_reading_(false)
+	, read_paused_(false)
+	, read_pause_count_(0)
+	, input_length_(0)
+	, output_length_(0)
+	, notsent_lowat_(0)
+	, write_lane_(kPriorityNormal)
+	, high_water_mark_(0)
+	, is_shaping_(false)
+	, shutdown_write_(false)
+	, close_after_flush_(false) {
 
 }
 
@@ -81,6 +122,18 @@ void TCPConn::send(const std::string& d) {
 }
 
 void TCPConn::send(const void* data, size_t len) {
+	send(data, len, kPriorityNormal);
+}
+
+void TCPConn::send(Buffer* buffer) {
+	send(buffer, kPriorityNormal);
+}
+
+void TCPConn::send(const std::string& d, Priority priority) {
+	send(d.c_str(), d.size(), priority);
+}
+
+void TCPConn::send(const void* data, size_t len, Priority priority) {
 	if (status_ != kConnected || len == 0) {
 		return;
 	}
@@ -89,24 +142,24 @@ void TCPConn::send(const void* data, size_t len) {
 	buffer.write(len, (const char*)data);
 	Piece* queue_head = buffer.moveToQueueHead();
 	if (loop_->isInLoopThread()) {
-		sendInLoop(queue_head);
+		sendInLoop(queue_head, priority);
 	}
 	else {
-		loop_->runInLoop(std::bind(&TCPConn::sendInLoop, shared_from_this(), queue_head));
+		loop_->runInLoop(std::bind(&TCPConn::sendInLoop, shared_from_this(), queue_head, priority));
 	}	
 }
 
-void TCPConn::send(Buffer* buffer) {
+void TCPConn::send(Buffer* buffer, Priority priority) {
 	if (status_ != kConnected || buffer->length() == 0) {
 		return;
 	}
 
 	Piece* queue_head =	buffer->moveToQueueHead();
 	if (loop_->isInLoopThread()) {
-		sendInLoop(queue_head);
+		sendInLoop(queue_head, priority);
 	}
 	else {
-		loop_->runInLoop(std::bind(&TCPConn::sendInLoop, shared_from_this(), queue_head));
+		loop_->runInLoop(std::bind(&TCPConn::sendInLoop, shared_from_this(), queue_head, priority));
 	}	
 }
 
@@ -136,10 +189,120 @@ void TCPConn::closeWithDelay(long seconds) {
 	}	
 }
 
+void TCPConn::shutdownWrite() {
+	if (status_ == kConnected) {
+		loop_->runInLoop(std::bind(&TCPConn::shutdownWriteInLoop, shared_from_this()));
+	}
+}
+
+void TCPConn::closeAfterFlush(long timeout_ms) {
+	StateE expected = kConnected;
+	if (status_.compare_exchange_strong(expected, kDisconnecting)) {
+		loop_->runInLoop(std::bind(&TCPConn::closeAfterFlushInLoop, shared_from_this(), timeout_ms));
+	}
+}
+
+void TCPConn::shutdownWriteInLoop() {
+	if (shutdown_write_ || status_ != kConnected) {
+		return;
+	}
+	shutdown_write_ = true;
+	if (!is_sending_ && outputLength() == 0) {
+		boost::system::error_code ec;
+		socket_->shutdown(socket_base::shutdown_send, ec);
+	}
+}
+
+void TCPConn::closeAfterFlushInLoop(long timeout_ms) {
+	assert(status_ == kDisconnecting);
+	if (!is_sending_ && outputLength() == 0) {
+		handleClose();
+		return;
+	}
+	close_after_flush_ = true;
+	auto guardThis = shared_from_this();
+	auto f = [guardThis]() {
+		if (guardThis->status_ == kDisconnecting) {
+			LOG_WARN << "TCPConn::closeAfterFlush - deadline hit with " << guardThis->outputLength() 
+				<< " bytes unsent, id: " << guardThis->id_;
+			guardThis->handleClose();
+		}
+	};
+	delay_close_timer_ = loop_->runAfter(boost::posix_time::milliseconds(timeout_ms), f);
+}
+
 void TCPConn::setTcpNoDelay(bool on) {
 	socket_->set_option(boost::asio::ip::tcp::no_delay(on));
 }
 
+void TCPConn::setSendRate(uint64_t bytes_per_second, uint64_t burst) {
+	auto guardThis = shared_from_this();
+	loop_->runInLoop([guardThis, bytes_per_second, burst]() {
+		if (bytes_per_second == 0) {
+			guardThis->send_bucket_.reset();
+		}
+		else if (guardThis->send_bucket_) {
+			guardThis->send_bucket_->setRate(bytes_per_second, burst);
+		}
+		else {
+			guardThis->send_bucket_.reset(new TokenBucket(bytes_per_second, burst));
+		}
+	});
+}
+
+void TCPConn::setNotSentLowat(int bytes) {
+	auto guardThis = shared_from_this();
+	loop_->runInLoop([guardThis, bytes]() {
+		if (bytes > 0) {
+			SocketOptions opts;
+			opts.notsent_lowat = bytes;
+			if (!applySocketOptions(*guardThis->socket_, opts)) {
+				return;
+			}
+		}
+		guardThis->notsent_lowat_ = bytes;
+	});
+}
+
+bool TCPConn::setRingInputBuffer(size_t capacity, const RingMessageCallback& cb) {
+	assert(loop_->isInLoopThread());
+	assert(!is_reading_ && input_buffer_.length() == 0);
+	if (is_reading_) {
+		return false;
+	}
+
+	std::unique_ptr<RingInputBuffer> ring(new RingInputBuffer);
+	if (!ring->init(capacity)) {
+		return false;
+	}
+	ring_input_ = std::move(ring);
+	ring_message_cb_ = cb;
+	return true;
+}
+
+TCPConnStats TCPConn::stats() const {
+	assert(loop_->isInLoopThread());
+	TCPConnStats s = stats_;
+	s.id = id_;
+	s.output_length = outputLength();
+	return s;
+}
+
+void TCPConn::getStats(const StatsCallback& cb) {
+	auto guardThis = shared_from_this();
+	loop_->runInLoop([guardThis, cb]() {
+		cb(guardThis->stats());
+	});
+}
+
+void TCPConn::pauseRead() {
+	loop_->runInLoop(std::bind(&TCPConn::pauseReadInLoop, shared_from_this()));
+}
+
+void TCPConn::resumeRead() {
+	loop_->runInLoop(std::bind(&TCPConn::resumeReadInLoop, shared_from_this()));
+}
+
 void TCPConn::connectEstablished() {
 	assert(loop_->isInLoopThread());
 	status_ = kConnected;
@@ -149,30 +312,173 @@ void TCPConn::connectEstablished() {
 	launchRead();
 }
 
-void TCPConn::sendInLoop(Piece* queue_head) {
-	output_buffer_.writePieceQueue(queue_head);
+void TCPConn::sendInLoop(Piece* queue_head, Priority priority) {
+	assert(priority >= 0 && priority < kPriorityLanes);
+	if (status_ == kDisconnected || shutdown_write_) {
+		while (queue_head) {
+			Piece* next = queue_head->next;
+			deletePiece(queue_head);
+			queue_head = next;
+		}
+		return;
+	}
+	size_t old_length = outputLength();
+	output_buffers_[priority].writePieceQueue(queue_head);
+	size_t length = outputLength();
+	if (high_water_mark_ > 0 && old_length < high_water_mark_ && length >= high_water_mark_ && high_water_mark_cb_) {
+		loop_->queueInLoop(std::bind(high_water_mark_cb_, shared_from_this(), length));
+	}
+	++stats_.messages_sent;
+	stats_.output_peak = std::max<uint64_t>(stats_.output_peak, length);
+	output_length_.store(length, std::memory_order_relaxed);
 	if (!is_sending_) {
-		is_sending_ = true;
-		Piece* piece = output_buffer_.readPiece();
-		socket_->async_send(boost::asio::buffer(piece->data + piece->off, piece->len),
-			std::bind(&TCPConn::handleWrite, this, piece, std::placeholders::_1));
+		launchWrite();
+	}
+}
+
+size_t TCPConn::outputLength() const {
+	size_t length = 0;
+	for (int i = 0; i < kPriorityLanes; ++i) {
+		length += output_buffers_[i].length();
+	}
+	return length;
+}
+
+TCPConn::OutputBuffer* TCPConn::nextOutputLane() {
+	if (output_buffers_[write_lane_].partialMessage() > 0) {
+		return &output_buffers_[write_lane_];
+	}
+	for (int i = 0; i < kPriorityLanes; ++i) {
+		if (output_buffers_[i].length() > 0) {
+			write_lane_ = i;
+			return &output_buffers_[i];
+		}
+	}
+	return nullptr;
+}
+
+Piece* TCPConn::takeOutputPiece() {
+	Piece* piece = nextOutputLane()->readPiece();
+	if (send_bucket_) {
+		send_bucket_->consume(piece->len);
+	}
+	if (shared_bucket_) {
+		shared_bucket_->consume(piece->len);
+	}
+	return piece;
+}
+
+int64_t TCPConn::shapingDelay() {
+	int64_t wait_us = 0;
+	if (send_bucket_) {
+		wait_us = send_bucket_->waitTime();
+	}
+	if (shared_bucket_) {
+		wait_us = std::max(wait_us, shared_bucket_->waitTime());
+	}
+	return wait_us;
+}
+
+void TCPConn::handleShapingTimer() {
+	is_shaping_ = false;
+	stats_.shaped_us += std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - shaping_start_).count();
+	if (status_ != kDisconnected && !is_sending_) {
+		launchWrite();
+	}
+}
+
+void TCPConn::handleWriteDrained() {
+	if (write_complete_cb_) {
+		write_complete_cb_(shared_from_this());
+	}
+	if (close_after_flush_ && status_ == kDisconnecting) {
+		handleClose();
+	}
+	else if (shutdown_write_ && status_ == kConnected) {
+		boost::system::error_code ec;
+		socket_->shutdown(socket_base::shutdown_send, ec);
 	}
 }
 
 void TCPConn::launchWrite() {
-	if (output_buffer_.length() > 0) {
+	if (is_shaping_) {
+		return;
+	}
+	if (outputLength() > 0) {
+		int64_t wait_us = shapingDelay();
+		if (wait_us > 0) {
+			// out of tokens, retry when the refill covers the overdraft
+			is_shaping_ = true;
+			++stats_.shaped_waits;
+			shaping_start_ = std::chrono::steady_clock::now();
+			shaping_timer_ = loop_->runAfter(boost::posix_time::microseconds(wait_us)
+				, std::bind(&TCPConn::handleShapingTimer, shared_from_this()));
+			return;
+		}
 		is_sending_ = true;
-		Piece* piece = output_buffer_.readPiece();
-		socket_->async_send(boost::asio::buffer(piece->data + piece->off, piece->len),
-			std::bind(&TCPConn::handleWrite, shared_from_this(), piece, std::placeholders::_1));
+		write_start_ = std::chrono::steady_clock::now();
+		if (notsent_lowat_ > 0) {
+			// the socket only reports writable once unsent bytes drop below the mark
+			socket_->async_write_some(boost::asio::null_buffers(),
+				std::bind(&TCPConn::handleWritable, shared_from_this(), std::placeholders::_1));
+		}
+		else {
+			asyncWritePiece(takeOutputPiece());
+		}
+	}
+}
+
+void TCPConn::handleWritable(const boost::system::error_code &ec) {
+	if (status_ == kDisconnected) {
+		is_sending_ = false;
+		return;
+	}
+	if (!ec && outputLength() > 0) {
+		asyncWritePiece(takeOutputPiece());
+		return;
 	}
+	is_sending_ = false;
+	if (ec && ec != boost::asio::error::operation_aborted) {
+		handleError();
+	}
+}
+
+void TCPConn::asyncWritePiece(Piece* piece) {
+	output_length_.store(outputLength(), std::memory_order_relaxed);
+	socket_->async_send(boost::asio::buffer(piece->data + piece->off, piece->len),
+		std::bind(&TCPConn::handleWrite, shared_from_this(), piece, std::placeholders::_1, std::placeholders::_2));
 }
 
-void TCPConn::handleWrite(Piece* piece, const boost::system::error_code &ec) {
+void TCPConn::handleWrite(Piece* piece, const boost::system::error_code &ec, size_t bytes_transferred) {
+	if (status_ == kDisconnected) {
+		// completed just before handleClose took the socket away
+		is_sending_ = false;
+		deletePiece(piece);
+		return;
+	}
+	if (!ec) {
+		++stats_.write_calls;
+		stats_.bytes_written += bytes_transferred;
+		if (bytes_transferred < piece->len) {
+			// short write, e.g. the send buffer or TCP_NOTSENT_LOWAT is full
+			piece->off += bytes_transferred;
+			piece->len -= bytes_transferred;
+			asyncWritePiece(piece);
+			return;
+		}
+	}
 	is_sending_ = false;
+	stats_.write_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - write_start_).count();
 	deletePiece(piece);
 	if (!ec) {
-		launchWrite();
+		if (outputLength() > 0) {
+			launchWrite();
+		}
+		else {
+			handleWriteDrained();
+		}
 	}
 	else if (ec != boost::asio::error::operation_aborted) {
 		handleError();
@@ -180,17 +486,48 @@ void TCPConn::handleWrite(Piece* piece, const boost::system::error_code &ec) {
 }
 
 void TCPConn::launchRead() {
+	if (ring_input_) {
+		launchRingRead();
+		return;
+	}
+	is_reading_ = true;
 	Piece* piece = newPiece();
-	socket_->async_read_some(boost::asio::buffer(piece->data + piece->off, sizeof(piece->data) - piece->off),
+	socket_->async_read_some(boost::asio::buffer(piece->data + piece->off, kPieceCapacity - piece->off),
 		std::bind(&TCPConn::handleRead, shared_from_this(), piece, std::placeholders::_1, std::placeholders::_2));
 }
 
+void TCPConn::pauseReadInLoop() {
+	++read_pause_count_;
+	read_paused_ = true;
+}
+
+void TCPConn::resumeReadInLoop() {
+	if (read_pause_count_ == 0 || --read_pause_count_ > 0) {
+		return;
+	}
+	read_paused_ = false;
+	if (!is_reading_ && status_ == kConnected) {
+		launchRead();
+	}
+}
+
 void TCPConn::handleRead(Piece* piece, const boost::system::error_code &ec, size_t bytes_transferred) {
+	if (status_ == kDisconnected) {
+		is_reading_ = false;
+		deletePiece(piece);
+		return;
+	}
+	is_reading_ = false;
 	if (!ec) {
 		piece->len = bytes_transferred;
+		++stats_.read_calls;
+		stats_.bytes_read += bytes_transferred;
 		input_buffer_.writePiece(piece);
 		message_cb_(shared_from_this(), &input_buffer_);		
-		launchRead();
+		input_length_.store(input_buffer_.length(), std::memory_order_relaxed);
+		if (!read_paused_) {
+			launchRead();
+		}
 	}
 	else {
 		deletePiece(piece);
@@ -200,6 +537,38 @@ void TCPConn::handleRead(Piece* piece, const boost::system::error_code &ec, size
 	}
 }
 
+void TCPConn::launchRingRead() {
+	if (ring_input_->writable() == 0) {
+		LOG_ERROR << "TCPConn::launchRingRead - ring input buffer full, id: " << id_;
+		handleError();
+		return;
+	}
+	is_reading_ = true;
+	socket_->async_read_some(boost::asio::buffer(ring_input_->beginWrite(), ring_input_->writable()),
+		std::bind(&TCPConn::handleRingRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+}
+
+void TCPConn::handleRingRead(const boost::system::error_code &ec, size_t bytes_transferred) {
+	if (status_ == kDisconnected) {
+		is_reading_ = false;
+		return;
+	}
+	is_reading_ = false;
+	if (!ec) {
+		ring_input_->hasWritten(bytes_transferred);
+		++stats_.read_calls;
+		stats_.bytes_read += bytes_transferred;
+		ring_message_cb_(shared_from_this(), ring_input_.get());
+		input_length_.store(ring_input_->length(), std::memory_order_relaxed);
+		if (!read_paused_ && status_ == kConnected) {
+			launchRingRead();
+		}
+	}
+	else if (ec != boost::asio::error::operation_aborted) {
+		handleError();
+	}
+}
+
 void TCPConn::handleError() {
 	if (status_ != kDisconnected){ 
 		status_ = kDisconnecting;
@@ -215,6 +584,11 @@ void TCPConn::handleClose() {
 			delay_close_timer_->cancel();
 			delay_close_timer_.reset();
 		}
+		if (shaping_timer_) {
+			boost::system::error_code ec;
+			shaping_timer_->cancel(ec);
+			shaping_timer_.reset();
+		}
 
 		if (socket_) {
 			assert(socket_->is_open());
@@ -2,18 +2,59 @@
 #include <netpp/net/tcp_callbacks.h>
 #include <netpp/net/event_loop.h>
 #include <netpp/net/buffer.h>
+#include <netpp/net/ring_input_buffer.h>
+#include <netpp/net/token_bucket.h>
 #include <boost/asio.hpp>
 #include <boost/any.hpp>
 #include <queue>
+#include <deque>
 #include <atomic>
+#include <chrono>
+#include <algorithm>
 
 namespace netpp {
 using namespace boost::asio;
 
 class PiecePool;
+
+// Per-connection counters, written only by the connection's loop thread.
+struct TCPConnStats {
+	uint64_t id = 0;
+	uint64_t bytes_read = 0;
+	uint64_t bytes_written = 0;
+	uint64_t read_calls = 0;
+	uint64_t write_calls = 0;
+	uint64_t messages_sent = 0;		// send() calls queued
+	uint64_t output_length = 0;
+	uint64_t output_peak = 0;
+	uint64_t write_wait_us = 0;		// time spent with a write in flight
+	uint64_t shaped_waits = 0;		// writes deferred by rate shaping
+	uint64_t shaped_us = 0;
+
+	TCPConnStats& operator+=(const TCPConnStats& o) {
+		bytes_read += o.bytes_read;
+		bytes_written += o.bytes_written;
+		read_calls += o.read_calls;
+		write_calls += o.write_calls;
+		messages_sent += o.messages_sent;
+		output_length += o.output_length;
+		output_peak = std::max(output_peak, o.output_peak);
+		write_wait_us += o.write_wait_us;
+		shaped_waits += o.shaped_waits;
+		shaped_us += o.shaped_us;
+		return *this;
+	}
+};
+
 class TCPConn : public boost::noncopyable, public std::enable_shared_from_this<TCPConn>
 {
 public:
+	typedef std::function<void(const TCPConnStats& stats)> StatsCallback;
+	// Output lanes, writes drain the highest non-empty lane first but never
+	// switch lanes in the middle of a message (one send call).
+	enum Priority { kPriorityHigh, kPriorityNormal, kPriorityLow };
+	static const int kPriorityLanes = 3;
+
 	TCPConn(EventLoop* loop
 		, SocketPtr sock
 		, uint64_t id);
@@ -38,11 +79,61 @@ public:
 	void send(const std::string& d);
 	void send(const void* data, size_t len);	
 	void send(Buffer* buffer);
+	void send(const std::string& d, Priority priority);
+	void send(const void* data, size_t len, Priority priority);
+	void send(Buffer* buffer, Priority priority);
 
 	void close();
 	void closeWithDelay(long seconds);
+	// Send FIN once everything queued so far has been written, reading goes
+	// on until the peer closes. Later sends are dropped.
+	void shutdownWrite();
+	// Stop accepting sends and close as soon as the output backlog is fully
+	// written, or after timeout_ms at the latest.
+	void closeAfterFlush(long timeout_ms);
 	void setTcpNoDelay(bool on);	
 
+	// Paced writes: set TCP_NOTSENT_LOWAT to bytes and hand the kernel the
+	// next piece only when its unsent data is below the mark, so the backlog
+	// stays in the output buffer where later sends can still be reordered.
+	// 0 turns pacing off and leaves the socket option as it is.
+	void setNotSentLowat(int bytes);
+	bool isPacedWrite() const { return notsent_lowat_ > 0; }
+	// Token-bucket egress shaping in bytes per second, 0 removes the limit.
+	// While the bucket is empty writes are deferred on a loop timer and the
+	// backlog counts toward the high water mark.
+	void setSendRate(uint64_t bytes_per_second, uint64_t burst);
+	// Bucket shared with other connections (e.g. a server-wide cap), checked
+	// in addition to the connection's own. Set before connectEstablished().
+	void setSharedSendBucket(const std::shared_ptr<TokenBucket>& bucket) {
+		shared_bucket_ = bucket; }
+
+	// Bytes queued in user space and not yet handed to the kernel, safe to
+	// read from any thread.
+	size_t outputBufferLength() const {
+		return output_length_.load(std::memory_order_relaxed); }
+
+	// Stop/restart arming reads, the read already in flight still completes.
+	// Calls nest, so independent users (e.g. TCPServer's buffer budget and a
+	// ProtobufCodec worker pool) can pause the same connection: reading
+	// restarts once every pauseRead has been matched by a resumeRead.
+	// No read is armed while paused, so a FIN or RST from the peer is only
+	// noticed after the resume or when a write fails; until then the
+	// connection and its buffers stay around. Pair long pauses with a timeout
+	// or an idle check where that matters.
+	void pauseRead();
+	void resumeRead();
+	bool isReadPaused() const { return read_paused_; }
+	// Bytes left unconsumed in the input buffer after the last message callback,
+	// safe to read from any thread.
+	size_t inputBufferLength() const { 
+		return input_length_.load(std::memory_order_relaxed); }
+
+	// Counters snapshot, call from the connection's loop thread.
+	TCPConnStats stats() const;
+	// Snapshot taken on the loop thread, cb runs there.
+	void getStats(const StatsCallback& cb);
+
 	void setContext(const boost::any& context) {
 		context_ = context; }
 	const boost::any& getContext() const {
@@ -52,9 +143,21 @@ public:
 
 	void connectEstablished();
 
+	// Read into a mirror-mapped ring instead of the piece chain, cb replaces
+	// the message callback. Call it from the connection callback, before the
+	// first read is armed.
+	bool setRingInputBuffer(size_t capacity, const RingMessageCallback& cb);
+
 	void setConnectionCallback(const ConnectionCallback& cb) { connection_cb_ = cb; }
 	void setMessageCallback(const MessageCallback& cb) { message_cb_ = cb; }
 	void setCloseCallback(CloseCallback&& cb) { close_cb_ = std::move(cb); }
+	// Fired once each time the output backlog rises to mark, a producer
+	// should hold back until the write complete callback.
+	void setHighWaterMarkCallback(const HighWaterMarkCallback& cb, size_t mark) {
+		high_water_mark_cb_ = cb;
+		high_water_mark_ = mark; }
+	// Fired when the output backlog has been fully handed to the kernel.
+	void setWriteCompleteCallback(const WriteCompleteCallback& cb) { write_complete_cb_ = cb; }
 
 private:
 	enum StateE { kConnected, kDisconnecting, kDisconnected };
@@ -64,16 +167,37 @@ private:
 	};
 	class OutputBuffer : public Buffer {
 	public:
+		OutputBuffer() : partial_(0) {}
 		Piece* readPiece();
+		// Appends queue_head as one message.
 		void writePieceQueue(Piece* queue_head);
+		// Bytes left of the message the last readPiece stopped inside.
+		size_t partialMessage() const { return partial_; }
+	private:
+		std::deque<size_t> messages_;
+		size_t partial_;
 	};
 
 	void setState(StateE s) { status_ = s; }
-	void sendInLoop(Piece* queue_head);
+	void sendInLoop(Piece* queue_head, Priority priority);
+	size_t outputLength() const;
+	OutputBuffer* nextOutputLane();
+	Piece* takeOutputPiece();
+	int64_t shapingDelay();
+	void handleShapingTimer();
+	void handleWriteDrained();
+	void shutdownWriteInLoop();
+	void closeAfterFlushInLoop(long timeout_ms);
 	void launchWrite();
-	void handleWrite(Piece* piece, const boost::system::error_code &ec);
+	void asyncWritePiece(Piece* piece);
+	void handleWritable(const boost::system::error_code &ec);
+	void handleWrite(Piece* piece, const boost::system::error_code &ec, size_t bytes_transferred);
 	void launchRead();
+	void pauseReadInLoop();
+	void resumeReadInLoop();
 	void handleRead(Piece* piece, const boost::system::error_code &ec, size_t bytes_transferred);
+	void launchRingRead();
+	void handleRingRead(const boost::system::error_code &ec, size_t bytes_transferred);
 	void handleError();
 	void handleClose();
 
@@ -85,14 +209,35 @@ private:
 
 	std::atomic<StateE> status_;
 	bool is_sending_;
-	OutputBuffer output_buffer_;
+	bool is_reading_;
+	std::atomic<bool> read_paused_;
+	int read_pause_count_;
+	std::atomic<size_t> input_length_;
+	std::atomic<size_t> output_length_;
+	std::atomic<int> notsent_lowat_;
+	TCPConnStats stats_;
+	std::chrono::steady_clock::time_point write_start_;
+	OutputBuffer output_buffers_[kPriorityLanes];
+	int write_lane_;
+	size_t high_water_mark_;
+	std::unique_ptr<TokenBucket> send_bucket_;
+	std::shared_ptr<TokenBucket> shared_bucket_;
+	bool is_shaping_;
+	bool shutdown_write_;
+	bool close_after_flush_;
+	DealTimerPtr shaping_timer_;
+	std::chrono::steady_clock::time_point shaping_start_;
 	InputBuffer input_buffer_;
+	std::unique_ptr<RingInputBuffer> ring_input_;
 	boost::any context_;
 	DealTimerPtr delay_close_timer_;
 
 	//callbacks
 	ConnectionCallback connection_cb_;
 	MessageCallback message_cb_;
+	RingMessageCallback ring_message_cb_;
 	CloseCallback close_cb_;
+	HighWaterMarkCallback high_water_mark_cb_;
+	WriteCompleteCallback write_complete_cb_;
 };
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #include <netpp/net/tcp_server.h>
+#include <netpp/net/piece/piece_allocator.h>
+#include <netpp/base/logging.h>
 #include <boost/format.hpp>
+#include <algorithm>
 #include <cstdio>
+#include <mutex>
 
 namespace netpp {
+const long kBufferBudgetCheckMs = 100;
+
 TCPServer::TCPServer(EventLoop* loop
 	, const ip::tcp::endpoint& listenAddr
 	, const std::string& name
@@ -11,6 +17,14 @@ TCPServer::TCPServer(EventLoop* loop
 	, listen_addr_(listenAddr)
 	, name_(name)
 	, next_conn_id_(0)
+	, has_socket_options_(false)
+	, high_water_mark_(0)
+	, soft_limit_(0)
+	, hard_limit_(0)
+	, over_hard_limit_(false)
+	, stats_interval_ms_(0)
+	, stats_top_k_(0)
+	, drain_loops_done_(0)
 	, connection_cb_(internal::defaultConnectionCallback)
 	, message_cb_(internal::defaultMessageCallback)
 	, verify_address_cb_(internal::defaultVerifyAddressCallback) {
@@ -26,18 +40,32 @@ TCPServer::~TCPServer() {
 	}
 }
 
-bool TCPServer::start() {
+bool TCPServer::start(int backlog) {
 	assert(status_ == kNull);
 	status_.store(kStarting);
 	bool ok = pool_->start(true);
 	if (ok)	{
-		auto f = [this]() {
+		auto f = [this, backlog]() {
 			acceptor_.reset(new ip::tcp::acceptor(loop_->getIoService()));
 			acceptor_->open(listen_addr_.protocol());
 			acceptor_->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+			if (socket_options_.recv_buffer > 0) {
+				acceptor_->set_option(socket_base::receive_buffer_size(socket_options_.recv_buffer));
+			}
+			if (socket_options_.send_buffer > 0) {
+				acceptor_->set_option(socket_base::send_buffer_size(socket_options_.send_buffer));
+			}
 			acceptor_->bind(listen_addr_);
-			acceptor_->listen();
+			acceptor_->listen(backlog);
 			status_.store(kRunning);
+			if (soft_limit_ > 0 || hard_limit_ > 0) {
+				budget_timer_ = loop_->runEvery(boost::posix_time::milliseconds(kBufferBudgetCheckMs)
+					, std::bind(&TCPServer::checkBufferBudget, this));
+			}
+			if (stats_interval_ms_ > 0) {
+				stats_timer_ = loop_->runEvery(boost::posix_time::milliseconds(stats_interval_ms_)
+					, std::bind(&TCPServer::reportStats, this));
+			}
 			doAccept();
 		};
 
@@ -49,30 +77,76 @@ bool TCPServer::start() {
 
 void TCPServer::stop(DoneCallback on_stopped_cb) {
 	assert(status_ == kRunning);
-	loop_->runInLoop(std::bind(&TCPServer::stopInLoop, this, on_stopped_cb));
+	loop_->runInLoop(std::bind(&TCPServer::stopInLoop, this, on_stopped_cb, -1));
+}
+
+void TCPServer::drainAndStop(long timeout_ms, DoneCallback on_stopped_cb, DrainProgressCallback progress_cb) {
+	assert(status_ == kRunning);
+	assert(timeout_ms >= 0);
+	// handed over on the loop thread, which is where removeConnection reads it
+	loop_->runInLoop([this, on_stopped_cb, timeout_ms, progress_cb]() {
+		this->drain_progress_cb_ = progress_cb;
+		this->stopInLoop(on_stopped_cb, timeout_ms);
+	});
 }
 
-void TCPServer::stopInLoop(DoneCallback on_stopped_cb) {
+void TCPServer::stopInLoop(DoneCallback on_stopped_cb, long flush_timeout_ms) {
 	assert(loop_->isInLoopThread());
 
 	status_.store(kStopping);
 	substatus_.store(kStoppingListener);
 
+	stopListener();
+
+	if (connections_.empty()) {
+		loop_->queueInLoop(std::bind(&TCPServer::stopInloopSafe, this, on_stopped_cb));
+	}
+	else {
+		stopped_cb_ = on_stopped_cb;
+		closeConnectionsByLoop(flush_timeout_ms);
+	}
+}
+
+void TCPServer::stopListener() {
 	boost::system::error_code ingore_ec;
+	if (budget_timer_) {
+		budget_timer_->cancel(ingore_ec);
+		budget_timer_.reset();
+	}
+	if (stats_timer_) {
+		stats_timer_->cancel(ingore_ec);
+		stats_timer_.reset();
+	}
+	read_paused_.clear();
 	acceptor_->cancel(ingore_ec);
 	acceptor_->close(ingore_ec);
 	acceptor_.reset();
+}
 
-	if (connections_.empty()) {
-		loop_->queueInLoop(std::bind(&TCPServer::stopInloopSafe, this, on_stopped_cb));
+void TCPServer::closeConnectionsByLoop(long flush_timeout_ms) {
+	// one task per I/O loop instead of one cross-thread post per connection,
+	// the loops then close their connections in parallel
+	std::map<EventLoop*, std::vector<TCPConnPtr>> by_loop;
+	for (auto& c : connections_) {
+		by_loop[c.second->loop()].push_back(c.second);
 	}
-	else {
-		for (auto& c : connections_) {
-			if (c.second->isConnected()) {
-				c.second->close();
+
+	drain_left_.clear();
+	drain_loops_done_ = 0;
+	for (auto& l : by_loop) {
+		drain_left_[l.first] = l.second.size();
+		std::vector<TCPConnPtr> conns;
+		conns.swap(l.second);
+		l.first->runInLoop([conns, flush_timeout_ms]() {
+			for (auto& c : conns) {
+				if (flush_timeout_ms < 0) {
+					c->close();
+				}
+				else {
+					c->closeAfterFlush(flush_timeout_ms);
+				}
 			}
-		}
-		stopped_cb_ = on_stopped_cb;
+		});
 	}
 }
 
@@ -110,7 +184,17 @@ void TCPServer::doAccept() {
 
 void TCPServer::newConnection(EventLoop* io_loop, SocketPtr sock, const boost::system::error_code &ec) {	
 	if (!ec) {
-		bool veriy_success = verify_address_cb_(sock->remote_endpoint());
+		bool veriy_success = false;
+		if (over_hard_limit_) {
+			boost::system::error_code ignore_ec;
+			sock->close(ignore_ec);
+		}
+		else {
+			veriy_success = verify_address_cb_(sock->remote_endpoint());
+		}
+		if (veriy_success && has_socket_options_) {
+			applySocketOptions(*sock, socket_options_);
+		}
 		if (veriy_success) {
 			++next_conn_id_;
 
@@ -119,6 +203,15 @@ void TCPServer::newConnection(EventLoop* io_loop, SocketPtr sock, const boost::s
 			conn->setConnectionCallback(connection_cb_);
 			conn->setMessageCallback(message_cb_);
 			conn->setCloseCallback(std::bind(&TCPServer::removeConnection, this, std::placeholders::_1));
+			if (high_water_mark_cb_) {
+				conn->setHighWaterMarkCallback(high_water_mark_cb_, high_water_mark_);
+			}
+			if (write_complete_cb_) {
+				conn->setWriteCompleteCallback(write_complete_cb_);
+			}
+			if (send_bucket_) {
+				conn->setSharedSendBucket(send_bucket_);
+			}
 
 			io_loop->runInLoop(std::bind(&TCPConn::connectEstablished, conn));
 		}
@@ -133,10 +226,178 @@ void TCPServer::removeConnection(const TCPConnPtr& conn) {
 	auto f = [this, conn]() {
 		assert(this->loop_->isInLoopThread());
 		this->connections_.erase(conn->id());
+		this->read_paused_.erase(conn->id());
+		auto it = this->drain_left_.find(conn->loop());
+		if (it != this->drain_left_.end() && --it->second == 0) {
+			++this->drain_loops_done_;
+			if (this->drain_progress_cb_) {
+				this->drain_progress_cb_(this->drain_loops_done_, this->drain_left_.size(), this->connections_.size());
+			}
+		}
 		if (isStopping() && this->connections_.empty()) {
 			loop_->queueInLoop(std::bind(&TCPServer::stopInloopSafe, this, stopped_cb_));
 		}
 	};
 	loop_->runInLoop(f);
 }
-}
\ No newline at end of file
+
+void TCPServer::checkBufferBudget() {
+	assert(loop_->isInLoopThread());
+	if (!isRunning()) {
+		return;
+	}
+
+	size_t used = getPiecePoolStats().used_bytes;
+
+	if (hard_limit_ > 0) {
+		if (used >= hard_limit_ && !over_hard_limit_) {
+			over_hard_limit_ = true;
+			LOG_WARN << name_ << " buffer hard limit reached: " << used << " bytes, rejecting new connections";
+			if (hard_limit_cb_) {
+				hard_limit_cb_(used);
+			}
+		}
+		else if (used < hard_limit_ && over_hard_limit_) {
+			over_hard_limit_ = false;
+		}
+	}
+
+	if (soft_limit_ > 0) {
+		if (used > soft_limit_) {
+			pauseHeaviestReaders(used - soft_limit_);
+		}
+		else if (used < soft_limit_ - soft_limit_ / 4) {
+			resumePausedReaders();
+		}
+	}
+}
+
+void TCPServer::pauseHeaviestReaders(size_t excess) {
+	std::vector<std::pair<size_t, TCPConnPtr>> readers;
+	readers.reserve(connections_.size());
+	for (auto& c : connections_) {
+		size_t len = c.second->inputBufferLength();
+		if (len > 0 && read_paused_.find(c.first) == read_paused_.end() && c.second->isConnected()) {
+			readers.push_back(std::make_pair(len, c.second));
+		}
+	}
+	std::sort(readers.begin(), readers.end(), 
+		[](const std::pair<size_t, TCPConnPtr>& a, const std::pair<size_t, TCPConnPtr>& b) {
+		return a.first > b.first;
+	});
+
+	size_t paused_bytes = 0;
+	for (auto& r : readers) {
+		if (paused_bytes >= excess) {
+			break;
+		}
+		r.second->pauseRead();
+		read_paused_.insert(r.second->id());
+		paused_bytes += r.first;
+	}
+}
+
+void TCPServer::resumePausedReaders() {
+	for (uint64_t id : read_paused_) {
+		auto it = connections_.find(id);
+		if (it != connections_.end()) {
+			it->second->resumeRead();
+		}
+	}
+	read_paused_.clear();
+}
+
+void TCPServer::setSendRateLimit(uint64_t bytes_per_second, uint64_t burst) {
+	auto f = [this, bytes_per_second, burst]() {
+		if (send_bucket_) {
+			// connections hold the same bucket, a rate of 0 lets them through
+			send_bucket_->setRate(bytes_per_second, burst);
+		}
+		else if (bytes_per_second > 0) {
+			send_bucket_.reset(new TokenBucket(bytes_per_second, burst));
+		}
+	};
+	loop_->runInLoop(f);
+}
+
+void TCPServer::collectStats(size_t top_k, StatsReportCallback&& cb) {
+	loop_->runInLoop(std::bind(&TCPServer::collectStatsInLoop, this, top_k, std::move(cb)));
+}
+
+namespace {
+struct StatsCollector {
+	std::mutex mutex;
+	size_t pending;
+	std::vector<TCPConnStats> conns;
+};
+}
+
+void TCPServer::collectStatsInLoop(size_t top_k, const StatsReportCallback& cb) {
+	assert(loop_->isInLoopThread());
+	auto collector = std::make_shared<StatsCollector>();
+	collector->pending = connections_.size();
+	collector->conns.reserve(connections_.size());
+
+	auto finish = [collector, top_k, cb]() {
+		TCPServerStats stats;
+		stats.connections = collector->conns.size();
+		for (auto& c : collector->conns) {
+			stats.total += c;
+		}
+		size_t k = std::min(top_k, collector->conns.size());
+		std::partial_sort(collector->conns.begin(), collector->conns.begin() + k, collector->conns.end(),
+			[](const TCPConnStats& a, const TCPConnStats& b) {
+			return a.bytes_read + a.bytes_written > b.bytes_read + b.bytes_written;
+		});
+		stats.top.assign(collector->conns.begin(), collector->conns.begin() + k);
+		cb(stats);
+	};
+
+	if (connections_.empty()) {
+		finish();
+		return;
+	}
+
+	EventLoop* loop = loop_;
+	for (auto& c : connections_) {
+		c.second->getStats([collector, loop, finish](const TCPConnStats& s) {
+			bool last = false;
+			{
+				std::lock_guard<std::mutex> lock(collector->mutex);
+				collector->conns.push_back(s);
+				last = --collector->pending == 0;
+			}
+			if (last) {
+				loop->runInLoop(finish);
+			}
+		});
+	}
+}
+
+void TCPServer::reportStats() {
+	assert(loop_->isInLoopThread());
+	if (!isRunning()) {
+		return;
+	}
+	if (stats_report_cb_) {
+		collectStatsInLoop(stats_top_k_, stats_report_cb_);
+	}
+	else {
+		collectStatsInLoop(stats_top_k_, std::bind(&TCPServer::logStats, this, std::placeholders::_1));
+	}
+}
+
+void TCPServer::logStats(const TCPServerStats& stats) {
+	LOG_INFO << name_ << " connections: " << stats.connections
+		<< ", bytes read: " << stats.total.bytes_read
+		<< ", bytes written: " << stats.total.bytes_written
+		<< ", output buffered: " << stats.total.output_length;
+	for (auto& c : stats.top) {
+		LOG_INFO << name_ << " conn " << c.id
+			<< " read: " << c.bytes_read << "/" << c.read_calls
+			<< ", written: " << c.bytes_written << "/" << c.write_calls
+			<< ", output peak: " << c.output_peak
+			<< ", write wait us: " << c.write_wait_us;
+	}
+}
+}
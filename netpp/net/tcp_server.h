@@ -1,18 +1,29 @@
 #pragma once
 #include <netpp/net/tcp_conn.h>
+#include <netpp/net/socket_options.h>
 #include <netpp/net/event_loop_thread_pool.h>
 #include <boost/thread/latch.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <atomic> 
 #include <map>
+#include <set>
 
 namespace netpp {
 using namespace boost::asio;
 
+struct TCPServerStats {
+	size_t connections = 0;
+	TCPConnStats total;
+	std::vector<TCPConnStats> top;	// heaviest by bytes read + written
+};
+
 class TCPServer : public ServerStatus, public boost::noncopyable
 {
 public:
 	typedef std::function<void()> DoneCallback;
+	typedef std::function<void(size_t used_bytes)> BufferLimitCallback;
+	typedef std::function<void(const TCPServerStats& stats)> StatsReportCallback;
+	typedef std::function<void(size_t loops_drained, size_t loops_total, size_t connections_left)> DrainProgressCallback;
 
 	TCPServer(EventLoop* loop
 		, const ip::tcp::endpoint& listenAddr
@@ -22,8 +33,15 @@ public:
 
 	const std::string& getName() const { return name_; }
 	
-	bool start();
+	// backlog is the listen queue length handed to listen(2).
+	bool start(int backlog = socket_base::max_connections);
 	void stop(DoneCallback on_stopped_cb);
+	// Graceful stop: stop accepting, then every I/O loop flushes and closes its
+	// own connections in parallel, a connection still writing after timeout_ms
+	// is closed anyway. progress_cb runs on the server loop each time an I/O
+	// loop has no connections left, on_stopped_cb once the pool has exited.
+	void drainAndStop(long timeout_ms, DoneCallback on_stopped_cb
+		, DrainProgressCallback progress_cb = DrainProgressCallback());
 
 	// Set connection callback, Not thread safe.
 	void setConnectionCallback(ConnectionCallback&& cb){ 
@@ -32,16 +50,62 @@ public:
 		message_cb_ = std::move(cb); }
 	void setVerifyAddressCallback(VerifyAddressCallback&& cb){ 
 		verify_address_cb_ = std::move(cb); }
+	void setHighWaterMarkCallback(HighWaterMarkCallback&& cb, size_t mark) {
+		high_water_mark_cb_ = std::move(cb);
+		high_water_mark_ = mark; }
+	void setWriteCompleteCallback(WriteCompleteCallback&& cb) {
+		write_complete_cb_ = std::move(cb); }
+
+	// Aggregate egress cap shared by every connection of this server, on top
+	// of any per-connection TCPConn::setSendRate. 0 removes it. Connections
+	// accepted before the first call are not shaped by it.
+	void setSendRateLimit(uint64_t bytes_per_second, uint64_t burst);
+
+	// Applied to every accepted socket, call before start(). Buffer sizes are
+	// also set on the listener so the window scale is negotiated for them.
+	void setSocketOptions(const SocketOptions& opts) {
+		socket_options_ = opts;
+		has_socket_options_ = true; }
+
+	// Process-wide budget on bytes held in pieces, 0 disables a limit. Above
+	// soft_limit reads are paused on the connections holding the most buffered
+	// input, above hard_limit new connections are rejected. Paused peers that
+	// close are only noticed on resume (see TCPConn::pauseRead). Call before
+	// start().
+	void setBufferBudget(size_t soft_limit, size_t hard_limit) {
+		soft_limit_ = soft_limit;
+		hard_limit_ = hard_limit; }
+	void setBufferHardLimitCallback(BufferLimitCallback&& cb) {
+		hard_limit_cb_ = std::move(cb); }
+	bool isOverHardLimit() const { return over_hard_limit_; }
+
+	// Gather counters from every connection on its own loop, cb runs on the
+	// server loop once all of them answered.
+	void collectStats(size_t top_k, StatsReportCallback&& cb);
+	// Run collectStats every interval_ms, an empty cb logs the top connections.
+	// Call before start().
+	void setStatsReport(long interval_ms, size_t top_k, StatsReportCallback&& cb) {
+		stats_interval_ms_ = interval_ms;
+		stats_top_k_ = top_k;
+		stats_report_cb_ = std::move(cb); }
 
 protected:
 	typedef std::map<uint64_t, TCPConnPtr> ConnectionMap;
 		
-	void stopInLoop(DoneCallback on_stopped_cb);
+	void stopInLoop(DoneCallback on_stopped_cb, long flush_timeout_ms);
+	void stopListener();
+	void closeConnectionsByLoop(long flush_timeout_ms);
 	void stopInloopSafe(DoneCallback on_stopped_cb);
 	void stopThreadPool();
 	void doAccept();
 	void newConnection(EventLoop* io_loop, SocketPtr sock, const boost::system::error_code &ec);
 	void removeConnection(const TCPConnPtr& conn);
+	void checkBufferBudget();
+	void pauseHeaviestReaders(size_t excess);
+	void resumePausedReaders();
+	void collectStatsInLoop(size_t top_k, const StatsReportCallback& cb);
+	void reportStats();
+	void logStats(const TCPServerStats& stats);
 
 	EventLoop* loop_;
 	ip::tcp::endpoint listen_addr_;
@@ -51,11 +115,33 @@ protected:
 	ConnectionMap connections_;	
 	std::atomic_flag started_;
 	std::shared_ptr<EventLoopThreadPool> pool_;
+	SocketOptions socket_options_;
+	bool has_socket_options_;
+	std::shared_ptr<TokenBucket> send_bucket_;
+	size_t high_water_mark_;
+
+	size_t soft_limit_;
+	size_t hard_limit_;
+	std::atomic<bool> over_hard_limit_;
+	std::set<uint64_t> read_paused_;
+	DealTimerPtr budget_timer_;
+
+	long stats_interval_ms_;
+	size_t stats_top_k_;
+	DealTimerPtr stats_timer_;
+
+	std::map<EventLoop*, size_t> drain_left_;
+	size_t drain_loops_done_;
+	DrainProgressCallback drain_progress_cb_;
 
 	//callbacks
 	ConnectionCallback connection_cb_;
 	MessageCallback message_cb_;
 	VerifyAddressCallback verify_address_cb_;
+	HighWaterMarkCallback high_water_mark_cb_;
+	WriteCompleteCallback write_complete_cb_;
+	BufferLimitCallback hard_limit_cb_;
+	StatsReportCallback stats_report_cb_;
 	DoneCallback stopped_cb_;
 };
 }
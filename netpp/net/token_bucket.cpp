@@ -0,0 +1,52 @@
+#include <netpp/net/token_bucket.h>
+#include <algorithm>
+#include <cmath>
+
+namespace netpp {
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst)
+	: rate_(rate)
+	, burst_((double)burst)
+	, tokens_((double)burst)
+	, last_(Clock::now()) {
+}
+
+void TokenBucket::setRate(uint64_t rate, uint64_t burst) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	refill(Clock::now());
+	rate_ = rate;
+	burst_ = (double)burst;
+	tokens_ = std::min(tokens_, burst_);
+}
+
+uint64_t TokenBucket::rate() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return rate_;
+}
+
+int64_t TokenBucket::waitTime() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (rate_ == 0) {
+		return 0;
+	}
+	refill(Clock::now());
+	if (tokens_ >= 0) {
+		return 0;
+	}
+	return (int64_t)std::ceil(-tokens_ * 1000000.0 / rate_);
+}
+
+void TokenBucket::consume(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (rate_ == 0) {
+		return;
+	}
+	refill(Clock::now());
+	tokens_ -= (double)bytes;
+}
+
+void TokenBucket::refill(Clock::time_point now) {
+	double elapsed = std::chrono::duration<double>(now - last_).count();
+	last_ = now;
+	tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+}
+}
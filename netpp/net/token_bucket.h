@@ -0,0 +1,34 @@
+#pragma once
+#include <boost/noncopyable.hpp>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+namespace netpp {
+// Byte-rate limiter for the write path. A writer takes tokens for a whole
+// piece and may overdraw the bucket, the next write then waits until the
+// refill brings the balance back to zero. Safe to share between loops.
+class TokenBucket : public boost::noncopyable
+{
+public:
+	// rate in bytes per second, burst is the most that can accumulate
+	TokenBucket(uint64_t rate, uint64_t burst);
+
+	void setRate(uint64_t rate, uint64_t burst);
+	uint64_t rate() const;
+
+	// Microseconds until a write may go, 0 when it can go now.
+	int64_t waitTime();
+	void consume(size_t bytes);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	void refill(Clock::time_point now);
+
+	mutable std::mutex mutex_;
+	uint64_t rate_;
+	double burst_;
+	double tokens_;
+	Clock::time_point last_;
+};
+}
@@ -0,0 +1,45 @@
+#include <netpp/net/worker_pool.h>
+
+namespace netpp {
+WorkerPool::WorkerPool(uint32_t thread_num)
+	: thread_num_(thread_num > 0 ? thread_num : 1) {
+}
+
+WorkerPool::~WorkerPool() {
+	stop();
+}
+
+void WorkerPool::start() {
+	if (status_ == kRunning) {
+		return;
+	}
+	status_.store(kStarting);
+	io_service_.reset();
+	work_.reset(new boost::asio::io_service::work(io_service_));
+	for (uint32_t i = 0; i < thread_num_; ++i) {
+		threads_.emplace_back([this]() { io_service_.run(); });
+	}
+	status_.store(kRunning);
+}
+
+void WorkerPool::stop() {
+	if (threads_.empty()) {
+		return;
+	}
+	status_.store(kStopping);
+	work_.reset();
+	for (std::thread& t : threads_) {
+		t.join();
+	}
+	threads_.clear();
+	status_.store(kStopped);
+}
+
+void WorkerPool::post(Task&& task) {
+	io_service_.post(std::move(task));
+}
+
+WorkerPool::StrandPtr WorkerPool::newStrand() {
+	return std::make_shared<boost::asio::io_service::strand>(io_service_);
+}
+}
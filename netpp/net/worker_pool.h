@@ -0,0 +1,38 @@
+#pragma once
+#include <netpp/net/server_status.h>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace netpp {
+// Threads for CPU-bound work, off the I/O loops. They all run one shared
+// io_service, so whichever thread is idle picks up the next task. Tasks
+// posted through one strand run in order and never concurrently.
+class WorkerPool : public ServerStatus, public boost::noncopyable
+{
+public:
+	typedef std::function<void()> Task;
+	typedef std::shared_ptr<boost::asio::io_service::strand> StrandPtr;
+
+	explicit WorkerPool(uint32_t thread_num);
+	~WorkerPool();
+
+	void start();
+	// Lets the queued tasks finish, then joins the threads.
+	void stop();
+
+	void post(Task&& task);
+	StrandPtr newStrand();
+
+	uint32_t threadNum() const { return thread_num_; }
+
+private:
+	uint32_t thread_num_;
+	boost::asio::io_service io_service_;
+	std::unique_ptr<boost::asio::io_service::work> work_;
+	std::vector<std::thread> threads_;
+};
+}